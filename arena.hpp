@@ -0,0 +1,139 @@
+# pragma once
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <algorithm>
+# include <memory>
+# include <new>
+# include <string_view>
+# include <type_traits>
+# include <utility>
+# include <vector>
+
+// AST用のバンプアロケータ（解放はアリーナ単位でまとめて行う）
+class AstArena {
+public:
+  AstArena() = default;
+  AstArena(const AstArena&) = delete;
+  AstArena& operator=(const AstArena&) = delete;
+  ~AstArena() {
+    // トリビアルに破棄できないノードだけデストラクタを呼ぶ
+    for (auto iter = m_finalizers.rbegin(); iter != m_finalizers.rend(); ++iter) {
+      iter->destroy(iter->object);
+    }
+  }
+  // アリーナ上にオブジェクトを構築
+  template<typename T, typename... Args>
+  T* make(Args&&... args) {
+    T* const object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    ++m_objects;
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      m_finalizers.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+    }
+    return object;
+  }
+  // 文字列をアリーナへコピー
+  std::string_view copy(const std::string_view str) {
+    if (str.empty()) return {};
+    char* const data = static_cast<char*>(allocate(str.length(), 1));
+    std::memcpy(data, str.data(), str.length());
+    return std::string_view(data, str.length());
+  }
+  // 生の領域を確保
+  void* allocate(const size_t size, const size_t align) {
+    size_t padding = (align - reinterpret_cast<uintptr_t>(m_cursor) % align) % align;
+    if (m_remaining < size + padding) {
+      const size_t chunkSize = std::max(size + align, ChunkSize);
+      m_chunks.push_back(std::make_unique<std::byte[]>(chunkSize));
+      m_cursor = m_chunks.back().get();
+      m_remaining = chunkSize;
+      padding = (align - reinterpret_cast<uintptr_t>(m_cursor) % align) % align;
+    }
+    std::byte* const ptr = m_cursor + padding;
+    m_cursor = ptr + size;
+    m_remaining -= size + padding;
+    m_used += size;
+    return ptr;
+  }
+  // 確保したバイト数
+  size_t bytesUsed() const {
+    return m_used;
+  }
+  // makeで構築したオブジェクト（ノード）の数
+  size_t objectCount() const {
+    return m_objects;
+  }
+private:
+  static constexpr size_t ChunkSize = 64 * 1024;
+  struct Finalizer {
+    void* object;
+    void (*destroy)(void*);
+  };
+  std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+  std::byte* m_cursor = nullptr;
+  size_t m_remaining = 0;
+  size_t m_used = 0;
+  size_t m_objects = 0;
+  std::vector<Finalizer> m_finalizers;
+};
+
+// アリーナ上の可変長配列（要素はトリビアルにコピーできる型に限る）
+template<typename T>
+class ArenaVector {
+  static_assert(std::is_trivially_copyable_v<T>);
+public:
+  ArenaVector() = default;
+  explicit ArenaVector(AstArena& arena)
+    : m_arena(&arena) {}
+  void push_back(const T& value) {
+    if (m_size == m_capacity) grow();
+    m_data[m_size++] = value;
+  }
+  void clear() {
+    m_size = 0;
+  }
+  // 先頭size個だけを残す
+  void truncate(const size_t size) {
+    if (size < m_size) m_size = static_cast<uint32_t>(size);
+  }
+  size_t size() const {
+    return m_size;
+  }
+  bool empty() const {
+    return m_size == 0;
+  }
+  T& operator[](const size_t i) {
+    return m_data[i];
+  }
+  const T& operator[](const size_t i) const {
+    return m_data[i];
+  }
+  T& back() {
+    return m_data[m_size - 1];
+  }
+  T* begin() {
+    return m_data;
+  }
+  T* end() {
+    return m_data + m_size;
+  }
+  const T* begin() const {
+    return m_data;
+  }
+  const T* end() const {
+    return m_data + m_size;
+  }
+private:
+  AstArena* m_arena = nullptr;
+  T* m_data = nullptr;
+  uint32_t m_size = 0;
+  uint32_t m_capacity = 0;
+  // 容量を倍にする（古い領域はアリーナごと解放される）
+  void grow() {
+    const uint32_t capacity = m_capacity == 0 ? 4 : m_capacity * 2;
+    T* const data = static_cast<T*>(m_arena->allocate(sizeof(T) * capacity, alignof(T)));
+    if (m_size > 0) std::memcpy(data, m_data, sizeof(T) * m_size);
+    m_data = data;
+    m_capacity = capacity;
+  }
+};
@@ -1,9 +1,19 @@
 # pragma once
+# include <array>
 # include <memory>
 # include <vector>
 # include <string>
-# include <sstream>
+# include <string_view>
+# include <iterator>
 # include <concepts>
+# include <format>
+# include <type_traits>
+# include <utility>
+# include <deque>
+# include <unordered_map>
+
+# include "arena.hpp"
+# include "symbol.hpp"
 
 // 型
 enum class TypeKind {
@@ -17,331 +27,633 @@ enum class TypeKind {
 };
 
 namespace {
-  std::map<TypeKind, std::string> TypeKind2String = {
-    {TypeKind::Entjera, "entjera"},
-    {TypeKind::Reala, "reala"},
-    {TypeKind::Teksta, "teksta"},
-    {TypeKind::Bulea, "bulea"},
-    {TypeKind::Funkcia, "funkcia"},
-    {TypeKind::Klaso, "klaso"},
-    {TypeKind::Void, "void"},
+  // TypeKindの値で引く名前表（スレッド間で共有するので変更できない表にする）
+  constexpr std::array<std::string_view, static_cast<size_t>(TypeKind::Void) + 1> TypeKind2String = {
+    "entjera", "reala", "teksta", "bulea", "funkcia", "klaso", "void",
   };
 }
 
+// 型（TypeContextがinternするので同じ型は同じアドレスを持ち、ポインタ比較で等価判定できる）
 struct Type {
   TypeKind kind;
-  std::shared_ptr<Type> returnType;
-  std::shared_ptr<Type> paramType;
-  std::string className;
-  Type(TypeKind k) : kind(k) {}
-  static std::shared_ptr<Type> createFunction(std::shared_ptr<Type> param, std::shared_ptr<Type> ret) {
-    auto t = std::make_shared<Type>(TypeKind::Funkcia);
-    t->paramType = param;
-    t->returnType = ret;
-    return t;
-  }
+  const Type* returnType = nullptr;
+  const Type* paramType = nullptr;
+  std::string_view className;
+  constexpr Type(TypeKind k) : kind(k) {}
   std::string toString() const {
     if (kind == TypeKind::Funkcia && paramType && returnType) {
       return std::format("({} -> {})", paramType->toString(), returnType->toString());
     }
     if (kind == TypeKind::Klaso) {
-      return className;
+      return std::string(className);
     }
-    return TypeKind2String.at(kind);
+    return std::string(TypeKind2String[static_cast<size_t>(kind)]);
   }
 };
 
-// 基底ASTノード
+namespace {
+  // 基本型のシングルトン（TypeKindの値で引く）
+  constexpr Type PrimitiveTypes[] = {
+    Type(TypeKind::Entjera),
+    Type(TypeKind::Reala),
+    Type(TypeKind::Teksta),
+    Type(TypeKind::Bulea),
+    Type(TypeKind::Funkcia),
+    Type(TypeKind::Klaso),
+    Type(TypeKind::Void),
+  };
+}
+
+// 型のintern表
+class TypeContext {
+public:
+  TypeContext() = default;
+  TypeContext(const TypeContext&) = delete;
+  TypeContext& operator=(const TypeContext&) = delete;
+  // 基本型（シグネチャなしのfunkciaを含む）
+  static const Type* primitive(const TypeKind kind) {
+    return &PrimitiveTypes[static_cast<size_t>(kind)];
+  }
+  // 関数型 (param -> ret) を(param, ret)でhash-consする
+  const Type* function(const Type* param, const Type* ret) {
+    const auto [iter, inserted] = m_functions.try_emplace({param, ret}, nullptr);
+    if (inserted) {
+      Type& type = m_types.emplace_back(TypeKind::Funkcia);
+      type.paramType = param;
+      type.returnType = ret;
+      iter->second = &type;
+    }
+    return iter->second;
+  }
+  // クラス型をクラス名でinternする
+  const Type* klass(const std::string_view name) {
+    const auto iter = m_classes.find(name);
+    if (iter != m_classes.end()) return iter->second;
+    const std::string& key = m_classNames.emplace_back(name);
+    Type& type = m_types.emplace_back(TypeKind::Klaso);
+    type.className = key;
+    m_classes.emplace(key, &type);
+    return &type;
+  }
+private:
+  struct FunctionKeyHash {
+    size_t operator()(const std::pair<const Type*, const Type*>& key) const {
+      const size_t h = std::hash<const Type*>{}(key.first);
+      return h ^ (std::hash<const Type*>{}(key.second) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+    }
+  };
+  std::deque<Type> m_types;
+  std::deque<std::string> m_classNames;
+  std::unordered_map<std::pair<const Type*, const Type*>, const Type*, FunctionKeyHash> m_functions;
+  std::unordered_map<std::string_view, const Type*> m_classes;
+};
+
+// ノードの種類（パスはこれでswitchして分岐する）
+enum class NodeKind : uint8_t {
+  // 式
+  NumberLiteral, StringLiteral, BoolLiteral, VarRef, BinaryOp, Call, AtFunction, MemberAccess, Convert,
+  // 文
+  VarDecl, Assign, MemberAssign, FunctionDecl, Return, If, While, Block, ClassDecl,
+  // その他
+  Program,
+};
+
+// 変数の格納場所
+enum class Storage : uint8_t {
+  // 現在の関数のローカル変数
+  Local,
+  // トップレベルの変数（捕捉せず直接参照する）
+  Global,
+  // クロージャが捕捉した外側の変数
+  Capture,
+  // funkcioの本体から見た自分自身
+  Self,
+};
+
+// 変数の格納位置（Resolverが設定する）
+struct Slot {
+  Storage storage = Storage::Local;
+  // 捕捉されたうえで代入される変数は箱に入れて共有する
+  bool boxed = false;
+  uint32_t index = 0;
+};
+
+struct ASTNode;
+// ノードを字下げ付きでoutへ書き出す（明示的なスタックで辿るので、深い木でも再帰せず線形時間で書ける）
+template<std::output_iterator<char> Out>
+Out dump(const ASTNode& node, Out out, int indent = 0);
+
+// 基底ASTノード（ノードはAstArena上に確保され、アリーナごと解放される）
+// 仮想関数は持たず、種類はkindで見分ける（派生ノードへの変換はnodeCast、木全体の走査はASTVisitor）
 struct ASTNode {
-  virtual ~ASTNode() = default;
-  virtual std::string toString(const int indent = 0) const = 0;
-protected:
-  std::string indentStr(const int indent) const {
-    return std::string(indent*2, ' ');
+  const NodeKind kind;
+  // dumpの結果を文字列で返す（大きな木はdumpで出力先へ直接書く）
+  std::string toString(const int indent = 0) const {
+    std::string result;
+    dump(*this, std::back_inserter(result), indent);
+    return result;
   }
+  bool isExpression() const {
+    return kind <= NodeKind::Convert;
+  }
+protected:
+  explicit ASTNode(const NodeKind k)
+    : kind(k) {}
+  ~ASTNode() = default;
 };
 
 // 式ノード
 struct ExprNode : public ASTNode {
-  std::shared_ptr<Type> type;
+  // TypeCheckerが設定する静的な型（実行時まで分からなければnullptr）
+  const Type* type = nullptr;
+protected:
+  explicit ExprNode(const NodeKind k)
+    : ASTNode(k) {}
 };
 
 // 数値リテラル
 struct NumberLiteral : public ExprNode {
-  double value;
+  static constexpr NodeKind Kind = NodeKind::NumberLiteral;
+  // 整数はinteger、実数はrealに持つ
+  union {
+    int64_t integer;
+    double real;
+  };
   bool isInteger;
-  NumberLiteral(const double v, const bool isInt)
-    : value(v), isInteger(isInt) {}
-  std::string toString(const int indent = 0) const override {
-    if (isInteger) {
-      return std::format("{}NumberLiteral({})", indentStr(indent), static_cast<int>(value));
-    }
-    return std::format("{}NumberLiteral({})", indentStr(indent), value);
-  }
+  explicit NumberLiteral(const int64_t v)
+    : ExprNode(NodeKind::NumberLiteral), integer(v), isInteger(true) {}
+  explicit NumberLiteral(const double v)
+    : ExprNode(NodeKind::NumberLiteral), real(v), isInteger(false) {}
 };
 
 // 文字列リテラル
 struct StringLiteral : public ExprNode {
-  std::string value;
-  StringLiteral(const std::string& v)
-    : value(v) {}
-  std::string toString(const int indent = 0) const override {
-    return std::format("{}StringLiteral(\"{}\")", indentStr(indent), value);
-  }
+  static constexpr NodeKind Kind = NodeKind::StringLiteral;
+  std::string_view value;
+  StringLiteral(const std::string_view v)
+    : ExprNode(NodeKind::StringLiteral), value(v) {}
 };
 
 // 真偽値リテラル
 struct BoolLiteral : public ExprNode {
+  static constexpr NodeKind Kind = NodeKind::BoolLiteral;
   bool value;
   BoolLiteral(const bool v)
-    : value(v) {}
-  std::string toString(const int indent = 0) const override {
-    return std::format("{}BoolLiteral({})", indentStr(indent), value ? "vero" : "malvero");
-  }
+    : ExprNode(NodeKind::BoolLiteral), value(v) {}
 };
 
 // 変数参照
 struct VarRefNode : public ExprNode {
-  std::string name;
-  VarRefNode(const std::string& n)
-    : name(n) {}
-  std::string toString(const int indent = 0) const override {
-    return std::format("{}VarRef({})", indentStr(indent), name);
-  }
+  static constexpr NodeKind Kind = NodeKind::VarRef;
+  SymbolId name;
+  // Resolverが設定する格納位置
+  Slot slot;
+  VarRefNode(const SymbolId n)
+    : ExprNode(NodeKind::VarRef), name(n) {}
 };
 
 // 二項演算
 struct BinaryOpNode : public ExprNode {
+  static constexpr NodeKind Kind = NodeKind::BinaryOp;
   enum class OpType {
     Add, Sub, Mul, Div,
     Eq, NEq, LT, GT, LE, GE
   };
   OpType op;
-  std::shared_ptr<ExprNode> left;
-  std::shared_ptr<ExprNode> right;
-  BinaryOpNode(const OpType& o, const std::shared_ptr<ExprNode>& l, const std::shared_ptr<ExprNode>& r)
-    : op(o), left(l), right(r) {}
-  std::string toString(const int indent = 0) const override {
-    static const std::map<OpType, std::string> opNames{
-      {OpType::Add, "+"}, {OpType::Sub, "-"}, {OpType::Mul, "*"}, {OpType::Div, "/"},
-      {OpType::Eq, "=="}, {OpType::NEq, "!="}, {OpType::LT, "<"}, {OpType::GT, ">"}, {OpType::LE, "<="}, {OpType::GE, ">="}
-    };
-    std::ostringstream oss;
-    oss << indentStr(indent) << "BinaryOp(" << opNames.at(op) << ")\n";
-    oss << left->toString(indent+1) << "\n";
-    oss << right->toString(indent+1);
-    return oss.str();
-  }
+  ExprNode* left;
+  ExprNode* right;
+  BinaryOpNode(const OpType& o, ExprNode* l, ExprNode* r)
+    : ExprNode(NodeKind::BinaryOp), op(o), left(l), right(r) {}
 };
 
 // 関数呼び出し
 struct CallNode : public ExprNode {
-  std::shared_ptr<ExprNode> function;
-  std::shared_ptr<ExprNode> argument;
-  CallNode(const std::shared_ptr<ExprNode>& f, const std::shared_ptr<ExprNode>& a)
-    : function(f), argument(a) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "Call\n";
-    oss << indentStr(indent+1) << "function:\n" << function->toString(indent+2) << "\n";
-    oss << indentStr(indent+1) << "argument:\n" << argument->toString(indent+2);
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::Call;
+  ExprNode* function;
+  ExprNode* argument;
+  CallNode(ExprNode* f, ExprNode* a)
+    : ExprNode(NodeKind::Call), function(f), argument(a) {}
 };
 
 // アット関数
 struct AtFunctionNode : public ExprNode {
-  std::string paramName;
-  std::shared_ptr<Type> paramType;
-  std::shared_ptr<Type> returnType;
-  std::vector<std::shared_ptr<ASTNode>> body;
-  AtFunctionNode(const std::string& param, const std::shared_ptr<Type>& pType, const std::shared_ptr<Type>& rType)
-    : paramName(param), paramType(pType), returnType(rType) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "AtFunction(@(" << paramType->toString() << " " << paramName << ")" << returnType->toString() << ")\n";
-    oss << indentStr(indent+1) << "body:\n";
-    for (size_t i = 0; i < body.size(); ++i) {
-      oss << body[i]->toString(indent+2);
-      if (i < body.size() - 1) oss << "\n";
-    }
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::AtFunction;
+  SymbolId paramName;
+  const Type* paramType;
+  const Type* returnType;
+  ArenaVector<ASTNode*> body;
+  // Resolverが設定するフレームの大きさ（引数はスロット0）と捕捉する変数の取り出し元
+  uint32_t frameSize = 0;
+  ArenaVector<Slot> captures;
+  bool paramBoxed = false;
+  AtFunctionNode(AstArena& arena, const SymbolId param, const Type* pType, const Type* rType)
+    : ExprNode(NodeKind::AtFunction), paramName(param), paramType(pType), returnType(rType), body(arena), captures(arena) {}
 };
 
 // メンバーアクセス
 struct MemberAccessNode : public ExprNode {
-  std::shared_ptr<ExprNode> object;
-  std::string member;
-  MemberAccessNode(const std::shared_ptr<ExprNode>& obj, const std::string& m)
-    : object(obj), member(m) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "MemberAccess(." << member << ")\n";
-    oss << object->toString(indent+1);
-    return oss.str();
+  static constexpr NodeKind Kind = NodeKind::MemberAccess;
+  ExprNode* object;
+  SymbolId member;
+  MemberAccessNode(ExprNode* obj, const SymbolId m)
+    : ExprNode(NodeKind::MemberAccess), object(obj), member(m) {}
+};
+
+// 型変換（TypeCheckerが挿入する。変換先はtype）
+// entjeraからrealaへの変換と、静的な型が分からない値の実行時検査を表す
+struct ConvertNode : public ExprNode {
+  static constexpr NodeKind Kind = NodeKind::Convert;
+  ExprNode* operand;
+  ConvertNode(ExprNode* o, const Type* target)
+    : ExprNode(NodeKind::Convert), operand(o) {
+    type = target;
   }
 };
 
 // 文ノード
-struct StmtNode : public ASTNode {};
+struct StmtNode : public ASTNode {
+protected:
+  explicit StmtNode(const NodeKind k)
+    : ASTNode(k) {}
+};
 
 // 変数宣言
 struct VarDeclNode : public StmtNode {
-  std::string name;
-  std::shared_ptr<Type> type;
-  std::shared_ptr<ExprNode> initializer;
-  VarDeclNode(const std::string& n, const std::shared_ptr<Type>& t, const std::shared_ptr<ExprNode>& init)
-    : name(n), type(t), initializer(init) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "VarDecl(" << type->toString() << " " << name << ")";
-    if (initializer) {
-      oss << "\n" << indentStr(indent+1) << "initializer:\n";
-      oss << initializer->toString(indent+2);
-    }
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::VarDecl;
+  SymbolId name;
+  const Type* type = nullptr;
+  ExprNode* initializer;
+  // Resolverが設定する格納位置
+  Slot slot;
+  VarDeclNode(const SymbolId n, const Type* t, ExprNode* init)
+    : StmtNode(NodeKind::VarDecl), name(n), type(t), initializer(init) {}
 };
 
 // 代入
 struct AssignNode : public StmtNode {
-  std::string name;
-  std::shared_ptr<ExprNode> value;
-  AssignNode(const std::string& n, const std::shared_ptr<ExprNode>& v)
-    : name(n), value(v) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "Assign(" << name << ")\n";
-    oss << value->toString(indent+1);
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::Assign;
+  SymbolId name;
+  ExprNode* value;
+  // Resolverが設定する格納位置
+  Slot slot;
+  AssignNode(const SymbolId n, ExprNode* v)
+    : StmtNode(NodeKind::Assign), name(n), value(v) {}
+};
+
+// メンバーへの代入
+struct MemberAssignNode : public StmtNode {
+  static constexpr NodeKind Kind = NodeKind::MemberAssign;
+  ExprNode* object;
+  SymbolId member;
+  ExprNode* value;
+  MemberAssignNode(ExprNode* obj, const SymbolId m, ExprNode* v)
+    : StmtNode(NodeKind::MemberAssign), object(obj), member(m), value(v) {}
 };
 
 // 関数宣言
 struct FunctionDeclNode : public StmtNode {
-  std::string name;
-  std::string paramName;
-  std::shared_ptr<Type> paramType;
-  std::shared_ptr<Type> returnType;
-  std::vector<std::shared_ptr<ASTNode>> body;
-  FunctionDeclNode(const std::string& n, const std::string& param, const std::shared_ptr<Type>& pType, const std::shared_ptr<Type> rType)
-    : name(n), paramName(param), paramType(pType), returnType(rType) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "FunctionDecl(" << name << "(" << paramType->toString() << " " << paramName << ")" << returnType->toString() << ")\n";
-    oss << indentStr(indent+1) << "body:\n";
-    for (size_t i = 0; i < body.size(); ++i) {
-      oss << body[i]->toString(indent+2);
-      if (i < body.size() - 1) oss << "\n";
-    }
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::FunctionDecl;
+  SymbolId name;
+  SymbolId paramName;
+  const Type* paramType;
+  const Type* returnType;
+  ArenaVector<ASTNode*> body;
+  // Resolverが設定する関数名の格納位置、フレームの大きさ（引数はスロット0）、捕捉する変数の取り出し元
+  Slot slot;
+  uint32_t frameSize = 0;
+  ArenaVector<Slot> captures;
+  bool paramBoxed = false;
+  // 遅延解析でまだ解析していない本体の{と}の間のソース（解析するまでbodyは空）と、その先頭のソース上の位置・行・列
+  std::string_view pendingBody;
+  uint32_t pendingOffset = 0;
+  int pendingLine = 0;
+  int pendingColumn = 0;
+  FunctionDeclNode(AstArena& arena, const SymbolId n, const SymbolId param, const Type* pType, const Type* rType)
+    : StmtNode(NodeKind::FunctionDecl), name(n), paramName(param), paramType(pType), returnType(rType), body(arena), captures(arena) {}
 };
 
 // return文
 struct ReturnNode : public StmtNode {
-  std::shared_ptr<ExprNode> value;
-  ReturnNode(const std::shared_ptr<ExprNode>& v)
-    : value(v) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "Return\n";
-    oss << value->toString(indent+1);
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::Return;
+  ExprNode* value;
+  ReturnNode(ExprNode* v)
+    : StmtNode(NodeKind::Return), value(v) {}
 };
 
 // if文
 struct IfNode : public StmtNode {
-  std::shared_ptr<ExprNode> condition;
-  std::vector<std::shared_ptr<ASTNode>> thenBody;
-  std::vector<std::shared_ptr<ASTNode>> elseBody;
-  IfNode(const std::shared_ptr<ExprNode>& cond)
-    : condition(cond) {}
-  std::string toString(const int indent = 0) const override {
-    std::stringstream oss;
-    oss << indentStr(indent) << "If\n";
-    oss << indentStr(indent+1) << "condition:\n";
-    oss << condition->toString(indent+2) << "\n";
-    oss << indentStr(indent+1) << "then:\n";
-    for (size_t i = 0; i < thenBody.size(); ++i) {
-      oss << thenBody[i]->toString(indent+2);
-      if (i < thenBody.size() - 1) oss << "\n";
-    }
-    if (!elseBody.empty()) {
-      oss << "\n" << indentStr(indent+1) << "else:\n";
-      for (size_t i = 0; i < elseBody.size(); ++i) {
-        oss << elseBody[i]->toString(indent+2);
-        if (i < elseBody.size() - 1) oss << "\n";
-      }
-    }
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::If;
+  ExprNode* condition;
+  ArenaVector<ASTNode*> thenBody;
+  ArenaVector<ASTNode*> elseBody;
+  IfNode(AstArena& arena, ExprNode* cond)
+    : StmtNode(NodeKind::If), condition(cond), thenBody(arena), elseBody(arena) {}
 };
 
 // while文
 struct WhileNode : public StmtNode {
-  std::shared_ptr<ExprNode> condition;
-  std::vector<std::shared_ptr<ASTNode>> body;
-  WhileNode(const std::shared_ptr<ExprNode>& cond)
-    : condition(cond) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "While\n";
-    oss << indentStr(indent+1) << "condition:\n";
-    oss << condition->toString(indent+2) << "\n";
-    oss << indentStr(indent+1) << "body:\n";
-    for (size_t i = 0; i < body.size(); ++i) {
-      oss << body[i]->toString(indent+2);
-      if (i < body.size() - 1) oss << "\n";
-    }
-    return oss.str();
-  }
+  static constexpr NodeKind Kind = NodeKind::While;
+  ExprNode* condition;
+  ArenaVector<ASTNode*> body;
+  WhileNode(AstArena& arena, ExprNode* cond)
+    : StmtNode(NodeKind::While), condition(cond), body(arena) {}
+};
+
+// ブロック（Optimizerが条件の決まったifの枝を置き換える）
+struct BlockNode : public StmtNode {
+  static constexpr NodeKind Kind = NodeKind::Block;
+  ArenaVector<ASTNode*> body;
+  explicit BlockNode(AstArena& arena)
+    : StmtNode(NodeKind::Block), body(arena) {}
 };
 
 // クラス宣言
+// インスタンスのフィールドはfieldsの宣言順に並べる（メンバーの番号はフィールド、メソッドの順）
 struct ClassDeclNode : public StmtNode {
-  std::string name;
-  std::vector<std::shared_ptr<VarDeclNode>> fields;
-  std::vector<std::shared_ptr<FunctionDeclNode>> methods;
-  ClassDeclNode(const std::string& n)
-    : name(n) {}
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "ClassDecl(" << name << ")\n";
-    if (!fields.empty()) {
-      oss << indentStr(indent+1) << "fields:\n";
-      for (size_t i = 0; i < fields.size(); ++i) {
-        oss << fields[i]->toString(indent+2);
-        if (i < fields.size() - 1) oss << "\n";
-      }
+  static constexpr NodeKind Kind = NodeKind::ClassDecl;
+  SymbolId name;
+  const Type* type;
+  ArenaVector<VarDeclNode*> fields;
+  ArenaVector<FunctionDeclNode*> methods;
+  ClassDeclNode(AstArena& arena, const SymbolId n, const Type* t)
+    : StmtNode(NodeKind::ClassDecl), name(n), type(t), fields(arena), methods(arena) {}
+  // メンバーの番号（なければ-1）
+  int32_t find(const SymbolId member) const {
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i]->name == member) return static_cast<int32_t>(i);
     }
-    if (!methods.empty()) {
-      oss << "\n" << indentStr(indent+1) << "methods:\n";
-      for (size_t i = 0; i < methods.size(); ++i) {
-        oss << methods[i]->toString(indent+2);
-        if (i < methods.size() - 1) oss << "\n";
-      }
+    for (size_t i = 0; i < methods.size(); ++i) {
+      if (methods[i]->name == member) return static_cast<int32_t>(fields.size() + i);
     }
-    return oss.str();
+    return -1;
   }
 };
 
+// アリーナはノードのデストラクタを呼ばずに解放できる
+static_assert(std::is_trivially_destructible_v<AtFunctionNode>
+  && std::is_trivially_destructible_v<FunctionDeclNode>
+  && std::is_trivially_destructible_v<IfNode>
+  && std::is_trivially_destructible_v<WhileNode>
+  && std::is_trivially_destructible_v<BlockNode>
+  && std::is_trivially_destructible_v<ClassDeclNode>);
+
 // プログラム全体
 struct ProgramNode : public ASTNode {
-  std::vector<std::shared_ptr<ASTNode>> statements;
-  std::string toString(const int indent = 0) const override {
-    std::ostringstream oss;
-    oss << indentStr(indent) << "Program\n";
-    for (size_t i = 0; i < statements.size(); ++i) {
-      oss << statements[i]->toString(indent+2);
-      if (i < statements.size() - 1) oss << "\n";
+  static constexpr NodeKind Kind = NodeKind::Program;
+  ProgramNode()
+    : ASTNode(NodeKind::Program) {}
+  // 全ノードを保持するアリーナ
+  std::shared_ptr<AstArena> arena;
+  // 差分解析で前回の木から引き継いだ文が属するアリーナ
+  std::vector<std::shared_ptr<AstArena>> retained;
+  // ノードが参照する型
+  std::shared_ptr<TypeContext> types;
+  std::vector<ASTNode*> statements;
+  // Resolverが設定するグローバル変数の数
+  uint32_t frameSize = 0;
+};
+
+// kindを確かめて派生ノードへ変換する（種類が違えばnullptr）
+template<typename T, typename Node>
+requires std::derived_from<T, ASTNode> && std::derived_from<std::remove_const_t<Node>, ASTNode>
+auto nodeCast(Node* node) -> std::conditional_t<std::is_const_v<Node>, const T*, T*> {
+  using Result = std::conditional_t<std::is_const_v<Node>, const T*, T*>;
+  return node && node->kind == T::Kind ? static_cast<Result>(node) : nullptr;
+}
+
+// kindでswitchして派生クラスのvisitXxxを呼ぶCRTPの訪問者（仮想呼び出しがないので展開できる）
+// NodeをconstにするとconstなノードをVisitする。派生クラスが定義しないvisitXxxはvisitNodeへ回る
+template<typename Derived, typename Result = void, typename Node = ASTNode>
+class ASTVisitor {
+public:
+  template<typename T>
+  using Ref = std::conditional_t<std::is_const_v<Node>, const T&, T&>;
+  Result visit(Node& node) {
+    switch (node.kind) {
+      case NodeKind::NumberLiteral: return derived().visitNumberLiteral(static_cast<Ref<NumberLiteral>>(node));
+      case NodeKind::StringLiteral: return derived().visitStringLiteral(static_cast<Ref<StringLiteral>>(node));
+      case NodeKind::BoolLiteral: return derived().visitBoolLiteral(static_cast<Ref<BoolLiteral>>(node));
+      case NodeKind::VarRef: return derived().visitVarRef(static_cast<Ref<VarRefNode>>(node));
+      case NodeKind::BinaryOp: return derived().visitBinaryOp(static_cast<Ref<BinaryOpNode>>(node));
+      case NodeKind::Call: return derived().visitCall(static_cast<Ref<CallNode>>(node));
+      case NodeKind::AtFunction: return derived().visitAtFunction(static_cast<Ref<AtFunctionNode>>(node));
+      case NodeKind::MemberAccess: return derived().visitMemberAccess(static_cast<Ref<MemberAccessNode>>(node));
+      case NodeKind::Convert: return derived().visitConvert(static_cast<Ref<ConvertNode>>(node));
+      case NodeKind::VarDecl: return derived().visitVarDecl(static_cast<Ref<VarDeclNode>>(node));
+      case NodeKind::Assign: return derived().visitAssign(static_cast<Ref<AssignNode>>(node));
+      case NodeKind::MemberAssign: return derived().visitMemberAssign(static_cast<Ref<MemberAssignNode>>(node));
+      case NodeKind::FunctionDecl: return derived().visitFunctionDecl(static_cast<Ref<FunctionDeclNode>>(node));
+      case NodeKind::Return: return derived().visitReturn(static_cast<Ref<ReturnNode>>(node));
+      case NodeKind::If: return derived().visitIf(static_cast<Ref<IfNode>>(node));
+      case NodeKind::While: return derived().visitWhile(static_cast<Ref<WhileNode>>(node));
+      case NodeKind::Block: return derived().visitBlock(static_cast<Ref<BlockNode>>(node));
+      case NodeKind::ClassDecl: return derived().visitClassDecl(static_cast<Ref<ClassDeclNode>>(node));
+      case NodeKind::Program: return derived().visitProgram(static_cast<Ref<ProgramNode>>(node));
+    }
+    std::unreachable();
+  }
+  Result visitNode(Node&) { return Result(); }
+  Result visitNumberLiteral(Ref<NumberLiteral> node) { return derived().visitNode(node); }
+  Result visitStringLiteral(Ref<StringLiteral> node) { return derived().visitNode(node); }
+  Result visitBoolLiteral(Ref<BoolLiteral> node) { return derived().visitNode(node); }
+  Result visitVarRef(Ref<VarRefNode> node) { return derived().visitNode(node); }
+  Result visitBinaryOp(Ref<BinaryOpNode> node) { return derived().visitNode(node); }
+  Result visitCall(Ref<CallNode> node) { return derived().visitNode(node); }
+  Result visitAtFunction(Ref<AtFunctionNode> node) { return derived().visitNode(node); }
+  Result visitMemberAccess(Ref<MemberAccessNode> node) { return derived().visitNode(node); }
+  Result visitConvert(Ref<ConvertNode> node) { return derived().visitNode(node); }
+  Result visitVarDecl(Ref<VarDeclNode> node) { return derived().visitNode(node); }
+  Result visitAssign(Ref<AssignNode> node) { return derived().visitNode(node); }
+  Result visitMemberAssign(Ref<MemberAssignNode> node) { return derived().visitNode(node); }
+  Result visitFunctionDecl(Ref<FunctionDeclNode> node) { return derived().visitNode(node); }
+  Result visitReturn(Ref<ReturnNode> node) { return derived().visitNode(node); }
+  Result visitIf(Ref<IfNode> node) { return derived().visitNode(node); }
+  Result visitWhile(Ref<WhileNode> node) { return derived().visitNode(node); }
+  Result visitBlock(Ref<BlockNode> node) { return derived().visitNode(node); }
+  Result visitClassDecl(Ref<ClassDeclNode> node) { return derived().visitNode(node); }
+  Result visitProgram(Ref<ProgramNode> node) { return derived().visitNode(node); }
+protected:
+  ASTVisitor() = default;
+private:
+  Derived& derived() {
+    return static_cast<Derived&>(*this);
+  }
+};
+
+// dumpの1ノード分の展開（見出しを書き、子と区切りを出力順にitemsへ並べる）
+// 子は呼び出し側の明示的なスタックに積まれるので、このVisitorは再帰しない
+template<typename Out>
+class AstDumper : public ASTVisitor<AstDumper<Out>, void, const ASTNode> {
+public:
+  // dumpの作業単位（nodeがあればそのノード、なければ字下げしたtext）
+  struct Item {
+    const ASTNode* node;
+    int indent;
+    std::string_view text;
+  };
+  Out out;
+  int indent = 0;
+  std::vector<Item> items;
+  explicit AstDumper(Out o) : out(o) {}
+
+  void visitNumberLiteral(const NumberLiteral& node) {
+    if (node.isInteger) out = std::format_to(out, "NumberLiteral({})", node.integer);
+    else out = std::format_to(out, "NumberLiteral({})", node.real);
+  }
+  void visitStringLiteral(const StringLiteral& node) {
+    out = std::format_to(out, "StringLiteral(\"{}\")", node.value);
+  }
+  void visitBoolLiteral(const BoolLiteral& node) {
+    out = std::format_to(out, "BoolLiteral({})", node.value ? "vero" : "malvero");
+  }
+  void visitVarRef(const VarRefNode& node) {
+    out = std::format_to(out, "VarRef({})", name(node.name));
+  }
+  void visitBinaryOp(const BinaryOpNode& node) {
+    // OpTypeの値で引く
+    static constexpr std::array<std::string_view, 10> opNames = {
+      "+", "-", "*", "/", "==", "!=", "<", ">", "<=", ">=",
+    };
+    out = std::format_to(out, "BinaryOp({})\n", opNames[static_cast<size_t>(node.op)]);
+    child(node.left, indent + 1);
+    text("\n");
+    child(node.right, indent + 1);
+  }
+  void visitCall(const CallNode& node) {
+    out = std::format_to(out, "Call\n");
+    text("function:\n", indent + 1);
+    child(node.function, indent + 2);
+    text("\n");
+    text("argument:\n", indent + 1);
+    child(node.argument, indent + 2);
+  }
+  void visitAtFunction(const AtFunctionNode& node) {
+    out = std::format_to(out, "AtFunction(@({} {}){})\n", node.paramType->toString(), name(node.paramName), node.returnType->toString());
+    text("body:\n", indent + 1);
+    list(node.body, indent + 2);
+  }
+  void visitMemberAccess(const MemberAccessNode& node) {
+    out = std::format_to(out, "MemberAccess(.{})\n", name(node.member));
+    child(node.object, indent + 1);
+  }
+  void visitConvert(const ConvertNode& node) {
+    out = std::format_to(out, "Convert({})\n", node.type->toString());
+    child(node.operand, indent + 1);
+  }
+  void visitVarDecl(const VarDeclNode& node) {
+    out = std::format_to(out, "VarDecl({} {})", node.type->toString(), name(node.name));
+    if (node.initializer) {
+      text("\n");
+      text("initializer:\n", indent + 1);
+      child(node.initializer, indent + 2);
+    }
+  }
+  void visitAssign(const AssignNode& node) {
+    out = std::format_to(out, "Assign({})\n", name(node.name));
+    child(node.value, indent + 1);
+  }
+  void visitMemberAssign(const MemberAssignNode& node) {
+    out = std::format_to(out, "MemberAssign(.{})\n", name(node.member));
+    text("object:\n", indent + 1);
+    child(node.object, indent + 2);
+    text("\n");
+    text("value:\n", indent + 1);
+    child(node.value, indent + 2);
+  }
+  void visitFunctionDecl(const FunctionDeclNode& node) {
+    out = std::format_to(out, "FunctionDecl({}({} {}){})\n", name(node.name), node.paramType->toString(), name(node.paramName), node.returnType->toString());
+    text(node.pendingBody.empty() ? "body:\n" : "body: (not parsed)\n", indent + 1);
+    list(node.body, indent + 2);
+  }
+  void visitReturn(const ReturnNode& node) {
+    out = std::format_to(out, "Return\n");
+    child(node.value, indent + 1);
+  }
+  void visitIf(const IfNode& node) {
+    out = std::format_to(out, "If\n");
+    text("condition:\n", indent + 1);
+    child(node.condition, indent + 2);
+    text("\n");
+    text("then:\n", indent + 1);
+    list(node.thenBody, indent + 2);
+    if (!node.elseBody.empty()) {
+      text("\n");
+      text("else:\n", indent + 1);
+      list(node.elseBody, indent + 2);
+    }
+  }
+  void visitWhile(const WhileNode& node) {
+    out = std::format_to(out, "While\n");
+    text("condition:\n", indent + 1);
+    child(node.condition, indent + 2);
+    text("\n");
+    text("body:\n", indent + 1);
+    list(node.body, indent + 2);
+  }
+  void visitBlock(const BlockNode& node) {
+    out = std::format_to(out, "Block");
+    for (const ASTNode* stmt : node.body) {
+      text("\n");
+      child(stmt, indent + 1);
+    }
+  }
+  void visitClassDecl(const ClassDeclNode& node) {
+    out = std::format_to(out, "ClassDecl({})\n", name(node.name));
+    if (!node.fields.empty()) {
+      text("fields:\n", indent + 1);
+      list(node.fields, indent + 2);
+    }
+    if (!node.methods.empty()) {
+      text("\n");
+      text("methods:\n", indent + 1);
+      list(node.methods, indent + 2);
+    }
+  }
+  void visitProgram(const ProgramNode& node) {
+    out = std::format_to(out, "Program\n");
+    list(node.statements, indent + 2);
+  }
+private:
+  static std::string_view name(const SymbolId id) {
+    return symbolTable().name(id);
+  }
+  void child(const ASTNode* node, const int childIndent) {
+    items.push_back({node, childIndent, {}});
+  }
+  void text(const std::string_view str, const int textIndent = 0) {
+    items.push_back({nullptr, textIndent, str});
+  }
+  template<typename Nodes>
+  void list(const Nodes& nodes, const int childIndent) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (i > 0) text("\n");
+      child(nodes[i], childIndent);
     }
-    return oss.str();
   }
 };
 
+template<std::output_iterator<char> Out>
+Out dump(const ASTNode& root, Out out, const int rootIndent) {
+  using Dumper = AstDumper<Out>;
+  Dumper dumper(out);
+  std::vector<typename Dumper::Item> stack{{&root, rootIndent, {}}};
+  while (!stack.empty()) {
+    const typename Dumper::Item item = stack.back();
+    stack.pop_back();
+    dumper.out = std::fill_n(dumper.out, item.indent * 2, ' ');
+    if (!item.node) {
+      dumper.out = std::ranges::copy(item.text, dumper.out).out;
+      continue;
+    }
+    dumper.indent = item.indent;
+    dumper.items.clear();
+    dumper.visit(*item.node);
+    // 子と区切りは出力順に並んでいるので逆順に積む
+    stack.insert(stack.end(), dumper.items.rbegin(), dumper.items.rend());
+  }
+  return dumper.out;
+}
+
 template<typename T>
 requires std::derived_from<T, ASTNode>
 struct std::formatter<std::shared_ptr<T>> {
@@ -350,7 +662,7 @@ struct std::formatter<std::shared_ptr<T>> {
   }
   auto format(const std::shared_ptr<T>& node, std::format_context& ctx) const {
     if (node) {
-      return std::format_to(ctx.out(), "{}", node->toString());
+      return dump(*node, ctx.out());
     }
     return std::format_to(ctx.out(), "nullptr");
   }
@@ -0,0 +1,549 @@
+# pragma once
+# include <array>
+# include <bit>
+# include <cstdint>
+# include <cstring>
+# include <filesystem>
+# include <format>
+# include <fstream>
+# include <functional>
+# include <memory>
+# include <stdexcept>
+# include <string>
+# include <string_view>
+# include <thread>
+# include <unordered_map>
+# include <vector>
+# include <unistd.h>
+
+# include "ast.hpp"
+# include "source.hpp"
+
+// 構文解析結果（ProgramNode）のバイナリ形式
+// ヘッダ | 文字列の開始位置[stringCount + 1] | 文字列本体 | 型[typeCount] | ノード[nodeCount] | リスト[listCount] | 子の番号[indexCount]
+// ノードは子が先に来る順に並べ、子は番号で参照するので、読み込みは先頭から1回なぞるだけで済む
+// 数値は書き込んだ環境のバイト順のまま置く（同じ環境で作ったキャッシュを読む前提）
+namespace astfile {
+  constexpr std::array<char, 8> Magic = {'E', 'S', 'P', 'A', 'S', 'T', '\0', '\0'};
+  constexpr uint32_t Version = 2;
+  // 子がないことを表す番号
+  constexpr uint32_t None = UINT32_MAX;
+
+  struct Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t typeCount;
+    uint32_t nodeCount;
+    uint32_t listCount;
+    uint32_t indexCount;
+    // トップレベルの文のリスト
+    uint32_t program;
+    // 元のソースの長さとハッシュ
+    // ファイル名はsourceHashそのものなので、キーの衝突は長さと別の方式のハッシュsourceCheckで見分ける
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint64_t sourceCheck;
+  };
+  // kindと、関数型なら引数と戻り値の型の番号、klasoなら名前の文字列の番号
+  struct TypeRecord {
+    uint8_t kind;
+    uint8_t padding[3];
+    uint32_t a;
+    uint32_t b;
+  };
+  // ノードの種類ごとにfieldsの意味が決まる（子のノード、リスト、文字列、型の番号）
+  struct NodeRecord {
+    uint8_t kind;
+    uint8_t flag;
+    uint16_t padding;
+    uint32_t fields[5];
+  };
+  struct ListRecord {
+    uint32_t start;
+    uint32_t count;
+  };
+  static_assert(sizeof(Header) == 64 && sizeof(TypeRecord) == 12 && sizeof(NodeRecord) == 24 && sizeof(ListRecord) == 8);
+
+  // 読み込みのときに区間が収まるように4バイト境界へ揃える
+  constexpr size_t align(const size_t size) {
+    return (size + 3) & ~size_t{3};
+  }
+}
+
+// ソース内容の64ビットハッシュ（キャッシュのキーにする。実行ごとに変わらない）
+inline uint64_t contentHash(const std::string_view data) {
+  constexpr uint64_t Prime = 0x100000001b3;
+  uint64_t hash = 0xcbf29ce484222325 ^ data.length();
+  size_t i = 0;
+  for (; i + 8 <= data.length(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data.data() + i, 8);
+    hash = (hash ^ word) * Prime;
+    hash ^= hash >> 29;
+  }
+  for (; i < data.length(); ++i) hash = (hash ^ static_cast<unsigned char>(data[i])) * Prime;
+  hash ^= hash >> 32;
+  hash *= 0xff51afd7ed558ccd;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// contentHashと独立したソース内容の64ビットハッシュ（キーが衝突したキャッシュを読まないための照合用）
+inline uint64_t checkHash(const std::string_view data) {
+  constexpr uint64_t Multiplier = 0x9e3779b97f4a7c15;
+  uint64_t hash = 0x2545f4914f6cdd1d + data.length();
+  size_t i = 0;
+  for (; i + 8 <= data.length(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data.data() + i, 8);
+    hash = std::rotl(hash + word * Multiplier, 31) * 0xc2b2ae3d27d4eb4f;
+  }
+  for (; i < data.length(); ++i) hash = std::rotl(hash + static_cast<unsigned char>(data[i]) * Multiplier, 23) * 0x165667b19e3779f9;
+  hash ^= hash >> 29;
+  hash *= 0xbf58476d1ce4e5b9;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+// ProgramNodeをバイナリ形式へ書き出す（明示的なスタックで辿るので深い木でも再帰しない）
+class AstWriter : public ASTVisitor<AstWriter, void, const ASTNode> {
+public:
+  std::string write(const ProgramNode& program, const std::string_view source) {
+    std::vector<std::pair<const ASTNode*, bool>> stack;
+    for (auto iter = program.statements.rbegin(); iter != program.statements.rend(); ++iter) stack.push_back({*iter, false});
+    std::vector<const ASTNode*> children;
+    while (!stack.empty()) {
+      const auto [node, expanded] = stack.back();
+      stack.pop_back();
+      if (m_nodeIds.contains(node)) continue;
+      if (expanded) {
+        m_record = {};
+        m_record.kind = static_cast<uint8_t>(node->kind);
+        visit(*node);
+        m_nodeIds.emplace(node, static_cast<uint32_t>(m_nodes.size()));
+        m_nodes.push_back(m_record);
+        continue;
+      }
+      // 子をすべて書いてから自分を書く
+      stack.push_back({node, true});
+      children.clear();
+      collect(*node, children);
+      for (auto iter = children.rbegin(); iter != children.rend(); ++iter) stack.push_back({*iter, false});
+    }
+    astfile::Header header{};
+    header.magic = astfile::Magic;
+    header.version = astfile::Version;
+    header.program = list(program.statements);
+    header.sourceSize = source.length();
+    header.sourceHash = contentHash(source);
+    header.sourceCheck = checkHash(source);
+    std::vector<uint32_t> offsets{0};
+    for (const std::string_view str : m_strings) offsets.push_back(offsets.back() + static_cast<uint32_t>(str.length()));
+    header.stringCount = static_cast<uint32_t>(m_strings.size());
+    header.stringBytes = offsets.back();
+    header.typeCount = static_cast<uint32_t>(m_types.size());
+    header.nodeCount = static_cast<uint32_t>(m_nodes.size());
+    header.listCount = static_cast<uint32_t>(m_lists.size());
+    header.indexCount = static_cast<uint32_t>(m_indices.size());
+    std::string out;
+    append(out, &header, sizeof(header));
+    append(out, offsets.data(), offsets.size() * sizeof(uint32_t));
+    for (const std::string_view str : m_strings) out.append(str);
+    out.resize(astfile::align(out.size()), '\0');
+    append(out, m_types.data(), m_types.size() * sizeof(astfile::TypeRecord));
+    append(out, m_nodes.data(), m_nodes.size() * sizeof(astfile::NodeRecord));
+    append(out, m_lists.data(), m_lists.size() * sizeof(astfile::ListRecord));
+    append(out, m_indices.data(), m_indices.size() * sizeof(uint32_t));
+    return out;
+  }
+
+  void visitNumberLiteral(const NumberLiteral& node) {
+    m_record.flag = node.isInteger;
+    uint64_t bits;
+    if (node.isInteger) std::memcpy(&bits, &node.integer, sizeof(bits));
+    else std::memcpy(&bits, &node.real, sizeof(bits));
+    m_record.fields[0] = static_cast<uint32_t>(bits);
+    m_record.fields[1] = static_cast<uint32_t>(bits >> 32);
+  }
+  void visitStringLiteral(const StringLiteral& node) {
+    m_record.fields[0] = string(node.value);
+  }
+  void visitBoolLiteral(const BoolLiteral& node) {
+    m_record.flag = node.value;
+  }
+  void visitVarRef(const VarRefNode& node) {
+    m_record.fields[0] = symbol(node.name);
+  }
+  void visitBinaryOp(const BinaryOpNode& node) {
+    m_record.flag = static_cast<uint8_t>(node.op);
+    fields(id(node.left), id(node.right));
+  }
+  void visitCall(const CallNode& node) {
+    fields(id(node.function), id(node.argument));
+  }
+  void visitAtFunction(const AtFunctionNode& node) {
+    fields(symbol(node.paramName), type(node.paramType), type(node.returnType), list(node.body));
+  }
+  void visitMemberAccess(const MemberAccessNode& node) {
+    fields(id(node.object), symbol(node.member));
+  }
+  void visitConvert(const ConvertNode& node) {
+    fields(id(node.operand), type(node.type));
+  }
+  void visitVarDecl(const VarDeclNode& node) {
+    fields(symbol(node.name), type(node.type), id(node.initializer));
+  }
+  void visitAssign(const AssignNode& node) {
+    fields(symbol(node.name), id(node.value));
+  }
+  void visitMemberAssign(const MemberAssignNode& node) {
+    fields(id(node.object), symbol(node.member), id(node.value));
+  }
+  void visitFunctionDecl(const FunctionDeclNode& node) {
+    fields(symbol(node.name), symbol(node.paramName), type(node.paramType), type(node.returnType), list(node.body));
+  }
+  void visitReturn(const ReturnNode& node) {
+    fields(id(node.value));
+  }
+  void visitIf(const IfNode& node) {
+    fields(id(node.condition), list(node.thenBody), list(node.elseBody));
+  }
+  void visitWhile(const WhileNode& node) {
+    fields(id(node.condition), list(node.body));
+  }
+  void visitBlock(const BlockNode& node) {
+    fields(list(node.body));
+  }
+  void visitClassDecl(const ClassDeclNode& node) {
+    fields(symbol(node.name), list(node.fields), list(node.methods));
+  }
+  void visitProgram(const ProgramNode&) {
+    throw std::runtime_error("Nested Program node");
+  }
+private:
+  std::vector<std::string_view> m_strings;
+  std::unordered_map<std::string_view, uint32_t> m_stringIds;
+  std::vector<astfile::TypeRecord> m_types;
+  std::unordered_map<const Type*, uint32_t> m_typeIds;
+  std::vector<astfile::NodeRecord> m_nodes;
+  std::unordered_map<const ASTNode*, uint32_t> m_nodeIds;
+  std::vector<astfile::ListRecord> m_lists;
+  std::vector<uint32_t> m_indices;
+  astfile::NodeRecord m_record{};
+
+  static void append(std::string& out, const void* data, const size_t size) {
+    out.append(static_cast<const char*>(data), size);
+  }
+  template<typename... Fields>
+  void fields(const Fields... values) {
+    size_t i = 0;
+    ((m_record.fields[i++] = values), ...);
+  }
+  uint32_t string(const std::string_view str) {
+    const auto [iter, inserted] = m_stringIds.try_emplace(str, static_cast<uint32_t>(m_strings.size()));
+    if (inserted) m_strings.push_back(str);
+    return iter->second;
+  }
+  uint32_t symbol(const SymbolId id) {
+    return string(symbolTable().name(id));
+  }
+  uint32_t type(const Type* type) {
+    if (!type) return astfile::None;
+    const auto iter = m_typeIds.find(type);
+    if (iter != m_typeIds.end()) return iter->second;
+    astfile::TypeRecord record{};
+    record.kind = static_cast<uint8_t>(type->kind);
+    record.a = record.b = astfile::None;
+    if (type->kind == TypeKind::Funkcia && type->paramType && type->returnType) {
+      record.a = this->type(type->paramType);
+      record.b = this->type(type->returnType);
+    } else if (type->kind == TypeKind::Klaso) {
+      record.a = string(type->className);
+    }
+    const auto index = static_cast<uint32_t>(m_types.size());
+    m_types.push_back(record);
+    m_typeIds.emplace(type, index);
+    return index;
+  }
+  uint32_t id(const ASTNode* node) const {
+    return node ? m_nodeIds.at(node) : astfile::None;
+  }
+  template<typename Nodes>
+  uint32_t list(const Nodes& nodes) {
+    m_lists.push_back({static_cast<uint32_t>(m_indices.size()), static_cast<uint32_t>(nodes.size())});
+    for (const ASTNode* node : nodes) m_indices.push_back(id(node));
+    return static_cast<uint32_t>(m_lists.size() - 1);
+  }
+  // 子ノードを集める
+  struct Children : ASTVisitor<Children, void, const ASTNode> {
+    std::vector<const ASTNode*>& out;
+    explicit Children(std::vector<const ASTNode*>& o) : out(o) {}
+    void add(const ASTNode* node) {
+      if (node) out.push_back(node);
+    }
+    template<typename Nodes>
+    void addAll(const Nodes& nodes) {
+      for (const ASTNode* node : nodes) out.push_back(node);
+    }
+    void visitBinaryOp(const BinaryOpNode& node) { add(node.left); add(node.right); }
+    void visitCall(const CallNode& node) { add(node.function); add(node.argument); }
+    void visitAtFunction(const AtFunctionNode& node) { addAll(node.body); }
+    void visitMemberAccess(const MemberAccessNode& node) { add(node.object); }
+    void visitConvert(const ConvertNode& node) { add(node.operand); }
+    void visitVarDecl(const VarDeclNode& node) { add(node.initializer); }
+    void visitAssign(const AssignNode& node) { add(node.value); }
+    void visitMemberAssign(const MemberAssignNode& node) { add(node.object); add(node.value); }
+    void visitFunctionDecl(const FunctionDeclNode& node) { addAll(node.body); }
+    void visitReturn(const ReturnNode& node) { add(node.value); }
+    void visitIf(const IfNode& node) { add(node.condition); addAll(node.thenBody); addAll(node.elseBody); }
+    void visitWhile(const WhileNode& node) { add(node.condition); addAll(node.body); }
+    void visitBlock(const BlockNode& node) { addAll(node.body); }
+    void visitClassDecl(const ClassDeclNode& node) { addAll(node.fields); addAll(node.methods); }
+  };
+  static void collect(const ASTNode& node, std::vector<const ASTNode*>& out) {
+    Children(out).visit(node);
+  }
+};
+
+// バイナリ形式からProgramNodeを組み立てる（番号や種類が不正なら例外を投げる）
+class AstReader {
+public:
+  // sourceの長さとハッシュ（sourceHashはcontentHashの値）が書き込んだときのソースと一致しなければ読み込まない
+  static std::shared_ptr<ProgramNode> read(const std::string_view data, const std::string_view source, const uint64_t sourceHash) {
+    return AstReader(data).build(source, sourceHash);
+  }
+private:
+  std::string_view m_data;
+  astfile::Header m_header{};
+  // 各区間の先頭位置
+  size_t m_strings = 0;
+  size_t m_types = 0;
+  size_t m_nodes = 0;
+  size_t m_lists = 0;
+  size_t m_indices = 0;
+  std::shared_ptr<ProgramNode> m_program;
+  std::vector<const Type*> m_typeTable;
+  std::vector<ASTNode*> m_nodeTable;
+  std::vector<SymbolId> m_symbols;
+
+  explicit AstReader(const std::string_view data) : m_data(data) {}
+  [[noreturn]] static void invalid() {
+    throw std::runtime_error("Invalid AST cache");
+  }
+  template<typename T>
+  T load(const size_t offset) const {
+    T value;
+    std::memcpy(&value, m_data.data() + offset, sizeof(T));
+    return value;
+  }
+  std::shared_ptr<ProgramNode> build(const std::string_view source, const uint64_t sourceHash) {
+    if (m_data.length() < sizeof(astfile::Header)) invalid();
+    m_header = load<astfile::Header>(0);
+    if (m_header.magic != astfile::Magic || m_header.version != astfile::Version) invalid();
+    if (m_header.sourceSize != source.length() || m_header.sourceHash != sourceHash) invalid();
+    if (m_header.sourceCheck != checkHash(source)) invalid();
+    // 区間の大きさは64ビットで計算するので個数が大きくても桁あふれしない
+    const uint64_t offsetsEnd = sizeof(astfile::Header) + (uint64_t{m_header.stringCount} + 1) * sizeof(uint32_t);
+    m_strings = offsetsEnd;
+    m_types = astfile::align(offsetsEnd + m_header.stringBytes);
+    m_nodes = m_types + uint64_t{m_header.typeCount} * sizeof(astfile::TypeRecord);
+    m_lists = m_nodes + uint64_t{m_header.nodeCount} * sizeof(astfile::NodeRecord);
+    m_indices = m_lists + uint64_t{m_header.listCount} * sizeof(astfile::ListRecord);
+    if (m_indices + uint64_t{m_header.indexCount} * sizeof(uint32_t) != m_data.length()) invalid();
+    if (load<uint32_t>(sizeof(astfile::Header)) != 0 || stringOffset(m_header.stringCount) != m_header.stringBytes) invalid();
+
+    m_program = std::make_shared<ProgramNode>();
+    m_program->arena = std::make_shared<AstArena>();
+    m_program->types = std::make_shared<TypeContext>();
+    m_symbols.assign(m_header.stringCount, astfile::None);
+    m_typeTable.reserve(m_header.typeCount);
+    for (uint32_t i = 0; i < m_header.typeCount; ++i) m_typeTable.push_back(readType(load<astfile::TypeRecord>(m_types + i * sizeof(astfile::TypeRecord)), i));
+    m_nodeTable.reserve(m_header.nodeCount);
+    for (uint32_t i = 0; i < m_header.nodeCount; ++i) m_nodeTable.push_back(readNode(load<astfile::NodeRecord>(m_nodes + i * sizeof(astfile::NodeRecord))));
+    forEach(m_header.program, [&](ASTNode* node) { m_program->statements.push_back(node); });
+    return m_program;
+  }
+  uint32_t stringOffset(const uint32_t i) const {
+    return load<uint32_t>(sizeof(astfile::Header) + size_t{i} * sizeof(uint32_t));
+  }
+  std::string_view string(const uint32_t i) const {
+    if (i >= m_header.stringCount) invalid();
+    const uint32_t begin = stringOffset(i);
+    const uint32_t end = stringOffset(i + 1);
+    if (begin > end || end > m_header.stringBytes) invalid();
+    return m_data.substr(m_strings + begin, end - begin);
+  }
+  // 同じ文字列のinternは1回だけ行う
+  SymbolId symbol(const uint32_t i) {
+    const std::string_view name = string(i);
+    if (m_symbols[i] == astfile::None) m_symbols[i] = symbolTable().intern(name);
+    return m_symbols[i];
+  }
+  const Type* type(const uint32_t i) const {
+    if (i >= m_typeTable.size()) invalid();
+    return m_typeTable[i];
+  }
+  const Type* readType(const astfile::TypeRecord& record, const uint32_t self) {
+    if (record.kind > static_cast<uint8_t>(TypeKind::Void)) invalid();
+    const auto kind = static_cast<TypeKind>(record.kind);
+    if (kind == TypeKind::Klaso) return m_program->types->klass(string(record.a));
+    if (kind == TypeKind::Funkcia && record.a != astfile::None) {
+      // 型は参照先より後ろに並ぶ
+      if (record.a >= self || record.b >= self) invalid();
+      return m_program->types->function(type(record.a), type(record.b));
+    }
+    return TypeContext::primitive(kind);
+  }
+  // 既に読んだノード（子は親より前に並ぶ）
+  ASTNode* node(const uint32_t i) const {
+    if (i >= m_nodeTable.size()) invalid();
+    return m_nodeTable[i];
+  }
+  ExprNode* expr(const uint32_t i) const {
+    ASTNode* const result = node(i);
+    if (!result->isExpression()) invalid();
+    return static_cast<ExprNode*>(result);
+  }
+  ExprNode* optionalExpr(const uint32_t i) const {
+    return i == astfile::None ? nullptr : expr(i);
+  }
+  template<typename F>
+  void forEach(const uint32_t list, F&& f) const {
+    if (list >= m_header.listCount) invalid();
+    const auto record = load<astfile::ListRecord>(m_lists + size_t{list} * sizeof(astfile::ListRecord));
+    if (uint64_t{record.start} + record.count > m_header.indexCount) invalid();
+    for (uint32_t i = 0; i < record.count; ++i) f(node(load<uint32_t>(m_indices + (size_t{record.start} + i) * sizeof(uint32_t))));
+  }
+  void body(const uint32_t list, ArenaVector<ASTNode*>& out) const {
+    forEach(list, [&](ASTNode* node) { out.push_back(node); });
+  }
+  template<typename T, typename... Args>
+  T* make(Args&&... args) {
+    return m_program->arena->make<T>(std::forward<Args>(args)...);
+  }
+  ASTNode* readNode(const astfile::NodeRecord& record) {
+    const uint32_t* const f = record.fields;
+    AstArena& arena = *m_program->arena;
+    switch (static_cast<NodeKind>(record.kind)) {
+      case NodeKind::NumberLiteral: {
+        const uint64_t bits = f[0] | (uint64_t{f[1]} << 32);
+        if (record.flag) return make<NumberLiteral>(std::bit_cast<int64_t>(bits));
+        return make<NumberLiteral>(std::bit_cast<double>(bits));
+      }
+      case NodeKind::StringLiteral:
+        // キャッシュファイルは読み込み後に閉じるのでアリーナへ写す
+        return make<StringLiteral>(arena.copy(string(f[0])));
+      case NodeKind::BoolLiteral:
+        return make<BoolLiteral>(record.flag != 0);
+      case NodeKind::VarRef:
+        return make<VarRefNode>(symbol(f[0]));
+      case NodeKind::BinaryOp:
+        if (record.flag > static_cast<uint8_t>(BinaryOpNode::OpType::GE)) invalid();
+        return make<BinaryOpNode>(static_cast<BinaryOpNode::OpType>(record.flag), expr(f[0]), expr(f[1]));
+      case NodeKind::Call:
+        return make<CallNode>(expr(f[0]), expr(f[1]));
+      case NodeKind::AtFunction: {
+        auto* const node = make<AtFunctionNode>(arena, symbol(f[0]), type(f[1]), type(f[2]));
+        body(f[3], node->body);
+        return node;
+      }
+      case NodeKind::MemberAccess:
+        return make<MemberAccessNode>(expr(f[0]), symbol(f[1]));
+      case NodeKind::Convert:
+        return make<ConvertNode>(expr(f[0]), type(f[1]));
+      case NodeKind::VarDecl:
+        return make<VarDeclNode>(symbol(f[0]), type(f[1]), optionalExpr(f[2]));
+      case NodeKind::Assign:
+        return make<AssignNode>(symbol(f[0]), expr(f[1]));
+      case NodeKind::MemberAssign:
+        return make<MemberAssignNode>(expr(f[0]), symbol(f[1]), expr(f[2]));
+      case NodeKind::FunctionDecl: {
+        auto* const node = make<FunctionDeclNode>(arena, symbol(f[0]), symbol(f[1]), type(f[2]), type(f[3]));
+        body(f[4], node->body);
+        return node;
+      }
+      case NodeKind::Return:
+        return make<ReturnNode>(expr(f[0]));
+      case NodeKind::If: {
+        auto* const node = make<IfNode>(arena, expr(f[0]));
+        body(f[1], node->thenBody);
+        body(f[2], node->elseBody);
+        return node;
+      }
+      case NodeKind::While: {
+        auto* const node = make<WhileNode>(arena, expr(f[0]));
+        body(f[1], node->body);
+        return node;
+      }
+      case NodeKind::Block: {
+        auto* const node = make<BlockNode>(arena);
+        body(f[0], node->body);
+        return node;
+      }
+      case NodeKind::ClassDecl: {
+        const SymbolId name = symbol(f[0]);
+        auto* const node = make<ClassDeclNode>(arena, name, m_program->types->klass(symbolTable().name(name)));
+        forEach(f[1], [&](ASTNode* field) {
+          const auto decl = nodeCast<VarDeclNode>(field);
+          if (!decl) invalid();
+          node->fields.push_back(decl);
+        });
+        forEach(f[2], [&](ASTNode* method) {
+          const auto decl = nodeCast<FunctionDeclNode>(method);
+          if (!decl) invalid();
+          node->methods.push_back(decl);
+        });
+        return node;
+      }
+      default:
+        invalid();
+    }
+  }
+};
+
+// ソース内容のハッシュをキーにした構文解析結果のディスクキャッシュ
+// 内容が変わっていないソースはTokenizerとParserを通さず、mmapしたファイルから組み立てる
+class AstCache {
+public:
+  explicit AstCache(std::filesystem::path directory) : m_directory(std::move(directory)) {
+    std::filesystem::create_directories(m_directory);
+  }
+  // 見つからないか読めなければnullptr
+  std::shared_ptr<ProgramNode> load(const std::string_view source, const uint64_t hash) const {
+    const std::filesystem::path path = entry(hash);
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) return nullptr;
+    try {
+      const SourceFile file(path.string());
+      return AstReader::read(file.view(), source, hash);
+    } catch (const std::exception&) {
+      return nullptr;
+    }
+  }
+  // 一時ファイルに書いてから置き換えるので、同時に動く他のプロセスが書きかけを読むことはない
+  bool store(const ProgramNode& program, const std::string_view source, const uint64_t hash) const {
+    const std::filesystem::path path = entry(hash);
+    const std::filesystem::path temporary = std::format("{}.{}.{}.tmp", path.string(), ::getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    try {
+      const std::string data = AstWriter().write(program, source);
+      {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!out) throw std::runtime_error("Failed to write " + temporary.string());
+      }
+      std::filesystem::rename(temporary, path);
+      return true;
+    } catch (const std::exception&) {
+      std::error_code error;
+      std::filesystem::remove(temporary, error);
+      return false;
+    }
+  }
+private:
+  std::filesystem::path m_directory;
+  std::filesystem::path entry(const uint64_t hash) const {
+    return m_directory / std::format("{:016x}.espast", hash);
+  }
+};
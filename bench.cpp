@@ -0,0 +1,197 @@
+# include <algorithm>
+# include <fstream>
+# include <iostream>
+# include <map>
+# include <sstream>
+
+// 各フェーズの確保も数える
+# define ESPERO_COUNT_ALLOCATIONS
+# include "profile.hpp"
+# include "parser.hpp"
+# include "resolver.hpp"
+# include "typechecker.hpp"
+# include "optimizer.hpp"
+# include "compiler.hpp"
+# include "vm.hpp"
+
+// フロントエンドとVMのベンチマーク
+// 生成した大きな入力ごとにトークン化から実行までを繰り返し、フェーズごとの最良の時間とtokens/s・nodes/sを表示する
+// --repeatで繰り返す回数、--saveで結果を保存し、--baselineで保存した結果より--tolerance（%）を超えて遅いフェーズがあれば1で終わる
+
+// 生成する入力
+struct Workload {
+  std::string name;
+  std::string source;
+};
+
+// 括弧で深く入れ子にした式の宣言を並べる（値が大きくならないよう足し引きと倍にして戻すのを交互に）
+std::string deepExpressions(const size_t statements, const size_t depth) {
+  std::string out;
+  for (size_t i = 0; i < statements; ++i) {
+    std::string expr = "x";
+    for (size_t d = 0; d < depth; ++d) {
+      switch (d % 4) {
+        case 0: expr = std::format("({} + {})", expr, d); break;
+        case 1: expr = std::format("({} - {})", expr, d - 1); break;
+        case 2: expr = std::format("({} * 2)", expr); break;
+        default: expr = std::format("({} / 2)", expr); break;
+      }
+    }
+    std::format_to(std::back_inserter(out), "entjera x = {};\nx = {};\n", i, expr);
+  }
+  return out;
+}
+
+// 互いに呼び合う小さなfunkcioを大量に宣言し、最後のものを呼ぶ
+std::string manyFunctions(const size_t count) {
+  std::string out = "funkcio f0(entjera x) entjera {\n  reveni x;\n}\n";
+  for (size_t i = 1; i < count; ++i) {
+    std::format_to(std::back_inserter(out),
+      "funkcio f{}(entjera x) entjera {{\n  se (x < 1) {{ reveni 0; }}\n  entjera y = x * {} + 1;\n  reveni f{}(x - 1) + y;\n}}\n",
+      i, i % 7, i - 1);
+  }
+  std::format_to(std::back_inserter(out), "entjera rezulto = f{}(10);\n", count - 1);
+  return out;
+}
+
+// 長いコメント行の間に少しだけ文を置く
+std::string longComments(const size_t lines, const size_t width) {
+  std::string out;
+  const std::string comment = "// " + std::string(width, 'k') + "\n";
+  for (size_t i = 0; i < lines; ++i) {
+    out += comment;
+    if (i % 100 == 0) std::format_to(std::back_inserter(out), "entjera c{} = {};\n", i, i);
+  }
+  return out;
+}
+
+// 大きな文字列リテラル（一部はエスケープを含む）を連結する
+std::string bigStrings(const size_t count, const size_t length) {
+  std::string out = "teksta s = \"\";\n";
+  const std::string plain(length, 's');
+  for (size_t i = 0; i < count; ++i) {
+    if (i % 4 == 0) std::format_to(std::back_inserter(out), "teksta t{} = \"{}\\n\\\"{}\\\"\";\n", i, plain, i);
+    else std::format_to(std::back_inserter(out), "teksta t{} = \"{}\";\n", i, plain);
+  }
+  return out;
+}
+
+// 実行の重い入力（ループと再帰呼び出し）
+std::string hotLoop(const size_t iterations) {
+  return std::format("entjera i = 0;\nentjera sum = 0;\ndum (i < {}) {{\n  sum = sum + i * 2;\n  i = i + 1;\n}}\n", iterations);
+}
+std::string recursion(const size_t n) {
+  return std::format("funkcio fib(entjera n) entjera {{\n  se (n < 2) {{ reveni n; }}\n  reveni fib(n - 1) + fib(n - 2);\n}}\nentjera f = fib({});\n", n);
+}
+
+std::vector<Workload> workloads() {
+  return {
+    {"deep-expr", deepExpressions(2000, 64)},
+    {"functions", manyFunctions(20000)},
+    {"comments", longComments(200000, 120)},
+    {"strings", bigStrings(2000, 8192)},
+    {"loop", hotLoop(2000000)},
+    {"fib", recursion(24)},
+  };
+}
+
+// 1回分の全フェーズを計測する
+Profiler runOnce(const std::string_view source) {
+  Profiler profiler;
+  Tokenizer tokenizer(source);
+  TokenBuffer tokens = profiler.measure("tokenize", [&] { return tokenizer.buffer(); });
+  profiler.items(tokens.size(), "tokens");
+  Parser parser(std::move(tokens));
+  const std::shared_ptr<ProgramNode> program = profiler.measure("parse", [&] { return parser.parse(); });
+  profiler.items(program->arena->objectCount(), "nodes");
+  if (!parser.diagnostics().empty()) throw std::runtime_error(std::format("{}", parser.diagnostics().front()));
+  const size_t nodes = program->arena->objectCount();
+  profiler.measure("resolve", [&] { Resolver().resolve(*program); });
+  profiler.items(nodes, "nodes");
+  profiler.measure("typecheck", [&] { TypeChecker().check(*program); });
+  profiler.items(nodes, "nodes");
+  profiler.measure("optimize", [&] { Optimizer().optimize(*program); });
+  profiler.items(nodes, "nodes");
+  const BytecodeModule module = profiler.measure("compile", [&] { return Compiler().compile(*program); });
+  profiler.measure("execute", [&] { VM(module).run(); });
+  return profiler;
+}
+
+// 遅くなったかを比べる最短の時間（ミリ秒）
+constexpr double MinComparable = 1.0;
+
+// 保存した結果（1行に「入力 フェーズ ミリ秒」）
+using Results = std::map<std::pair<std::string, std::string>, double>;
+
+Results readResults(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) throw std::runtime_error("Failed to open a " + path);
+  Results results;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string workload, phase;
+    double time;
+    if (fields >> workload >> phase >> time) results[{workload, phase}] = time;
+  }
+  return results;
+}
+
+int main(int argc, char* argv[]) {
+  size_t repeat = 5;
+  std::string save;
+  std::string baseline;
+  double tolerance = 15.0;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--repeat" && i + 1 < argc) repeat = std::max<size_t>(1, std::stoul(argv[++i]));
+    else if (arg == "--save" && i + 1 < argc) save = argv[++i];
+    else if (arg == "--baseline" && i + 1 < argc) baseline = argv[++i];
+    else if (arg == "--tolerance" && i + 1 < argc) tolerance = std::stod(argv[++i]);
+    else {
+      std::cerr << "Usage: bench [--repeat N] [--save FILE] [--baseline FILE] [--tolerance PERCENT]" << std::endl;
+      return 1;
+    }
+  }
+  AllocationCounter::enabled = true;
+  const Results previous = baseline.empty() ? Results() : readResults(baseline);
+  Results results;
+  bool regressed = false;
+  std::cout << std::format("{:<10} {:<9} {:>10} {:>10} {:>12}  {}", "workload", "phase", "best(ms)", "allocs", "bytes", "throughput") << std::endl;
+  for (const Workload& workload : workloads()) {
+    // フェーズごとに最も速かった回を残す（確保は毎回同じなので最後の回の値）
+    std::vector<Profiler::Phase> best;
+    for (size_t r = 0; r < repeat; ++r) {
+      const Profiler profiler = runOnce(workload.source);
+      const std::vector<Profiler::Phase>& phases = profiler.phases();
+      if (best.empty()) best = phases;
+      for (size_t p = 0; p < phases.size(); ++p) {
+        const auto time = std::min(best[p].time, phases[p].time);
+        best[p] = phases[p];
+        best[p].time = time;
+      }
+    }
+    for (const Profiler::Phase& phase : best) {
+      const double time = Profiler::milliseconds(phase.time);
+      results[{workload.name, phase.name}] = time;
+      std::string line = std::format("{:<10} {:<9} {:>10.3f} {:>10} {:>12}", workload.name, phase.name, time, phase.allocations, phase.bytes);
+      if (phase.items > 0) std::format_to(std::back_inserter(line), "  {:.0f} {}/s", Profiler::rate(phase.items, phase.time), phase.unit);
+      const auto base = previous.find({workload.name, phase.name});
+      if (base != previous.end() && base->second > 0) {
+        const double change = (time / base->second - 1.0) * 100.0;
+        std::format_to(std::back_inserter(line), "  ({:+.1f}%)", change);
+        // 1ms未満のフェーズは揺れが大きいので遅くなったとは見なさない
+        if (change > tolerance && std::max(time, base->second) >= MinComparable) {
+          line += " REGRESSION";
+          regressed = true;
+        }
+      }
+      std::cout << line << std::endl;
+    }
+  }
+  if (!save.empty()) {
+    std::ofstream file(save);
+    for (const auto& [key, time] : results) file << std::format("{} {} {:.6f}\n", key.first, key.second, time);
+  }
+  return regressed ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+# pragma once
+# include <cstdint>
+# include <memory>
+# include <string>
+# include <vector>
+# include <format>
+
+# include "symbol.hpp"
+# include "value.hpp"
+
+// 命令一覧（列挙子・名前表・VMのディスパッチ表をここから生成する）
+# define ESPERO_OPCODES(X) \
+  /* 定数 */ \
+  X(Constant) X(Int) X(True) X(False) X(Nil) X(Pop) \
+  /* 変数（Boxedは箱に入れた変数、NewBoxは値を新しい箱に入れてローカル変数へ格納する） */ \
+  X(LoadLocal) X(StoreLocal) X(LoadGlobal) X(StoreGlobal) X(LoadCapture) X(LoadSelf) \
+  X(NewBox) X(LoadBoxed) X(StoreBoxed) X(LoadCaptureBoxed) X(StoreCaptureBoxed) \
+  /* 整数演算 */ \
+  X(AddInt) X(SubInt) X(MulInt) X(DivInt) \
+  X(EqInt) X(NEqInt) X(LtInt) X(GtInt) X(LeInt) X(GeInt) \
+  /* 実数演算 */ \
+  X(AddReal) X(SubReal) X(MulReal) X(DivReal) \
+  X(EqReal) X(NEqReal) X(LtReal) X(GtReal) X(LeReal) X(GeReal) \
+  /* 型が静的に決まらない演算 */ \
+  X(Add) X(Sub) X(Mul) X(Div) X(Eq) X(NEq) X(Lt) X(Gt) X(Le) X(Ge) \
+  X(Concat) \
+  /* 変換と検査（CheckTypeのオペランドはTypeKind、CheckClassはklasoの番号、CoerceParamは 引数のスロット << 8 | TypeKind） */ \
+  X(IntToReal) X(CoerceReal) X(CheckType) X(CheckClass) X(CoerceParam) \
+  /* klaso（Newはスタック上のフィールドの値からインスタンスを作り、Get/SetMemberのオペランドはアクセス箇所の番号） */ \
+  X(New) X(GetMember) X(SetMember) \
+  /* 制御（ジャンプ先は命令番号） */ \
+  X(Jump) X(JumpIfFalse) \
+  /* 関数（Closureはスタック上の捕捉する値を取り込み、CallDirectは特殊化した関数を複数の引数で呼ぶ） */ \
+  /* Tailは現在のフレームを再利用して呼び出し、結果をそのまま返す */ \
+  /* （オペランドの下位4ビットは戻り値の変換でTypeKind+1、TailCallDirectの上位は関数番号） */ \
+  X(Closure) X(Call) X(CallDirect) X(TailCall) X(TailCallDirect) X(Return) X(NoReturn)
+
+enum class OpCode : uint8_t {
+# define ESPERO_OPCODE_ENUM(name) name,
+  ESPERO_OPCODES(ESPERO_OPCODE_ENUM)
+# undef ESPERO_OPCODE_ENUM
+};
+
+namespace {
+  constexpr const char* OpCode2String[] = {
+# define ESPERO_OPCODE_NAME(name) #name,
+    ESPERO_OPCODES(ESPERO_OPCODE_NAME)
+# undef ESPERO_OPCODE_NAME
+  };
+}
+
+// 命令語（下位8ビットが命令、上位24ビットがオペランド）
+using Instruction = uint32_t;
+constexpr uint32_t MaxOperand = (1u << 24) - 1;
+
+constexpr Instruction encode(const OpCode op, const uint32_t operand = 0) {
+  return static_cast<uint32_t>(op) | (operand << 8);
+}
+constexpr OpCode opcodeOf(const Instruction word) {
+  return static_cast<OpCode>(word & 0xFF);
+}
+constexpr uint32_t operandOf(const Instruction word) {
+  return word >> 8;
+}
+// Int命令の即値（符号付き24ビット）
+constexpr int32_t immediateOf(const Instruction word) {
+  return static_cast<int32_t>(word) >> 8;
+}
+
+// コンパイル済みの関数
+struct FunctionProto {
+  SymbolId name = 0;
+  bool hasName = false;
+  // 引数の数（特殊化した関数以外は1）、ローカル変数の数（引数はスロット0から）、捕捉する変数の数
+  uint32_t arity = 1;
+  uint32_t frameSize = 0;
+  uint32_t captureCount = 0;
+  // オペランドスタックの最大の深さ
+  uint32_t maxStack = 0;
+  std::vector<Instruction> code;
+};
+
+// メンバーアクセスの箇所（VMはここからインラインキャッシュを作る）
+struct MemberSite {
+  SymbolId member;
+  // 静的に分かったklasoの番号とメンバーの番号（分からなければklassは-1）
+  int32_t klass;
+  uint32_t index;
+};
+
+// トップレベルで宣言された変数（実行後に結果を表示する）
+struct GlobalName {
+  SymbolId name;
+  uint32_t slot;
+};
+
+// コンパイル単位（functions[0]がトップレベル）
+struct BytecodeModule {
+  std::vector<FunctionProto> functions;
+  uint32_t globalCount = 0;
+  std::vector<Value> constants;
+  // インスタンスが指すので実行結果より長く保つ
+  std::vector<ClassInfo> classes;
+  std::vector<MemberSite> memberSites;
+  // トップレベルの変数の宣言順
+  std::vector<GlobalName> globals;
+  // classesが参照する型
+  std::shared_ptr<TypeContext> types;
+};
+
+// 逆アセンブル
+inline std::string disassemble(const BytecodeModule& module) {
+  std::string out;
+  for (size_t f = 0; f < module.functions.size(); ++f) {
+    const FunctionProto& proto = module.functions[f];
+    std::format_to(std::back_inserter(out), "function #{} {} (params:{}, frame:{}, captures:{}, stack:{})\n",
+      f, proto.hasName ? symbolTable().name(proto.name) : "<anonymous>", proto.arity, proto.frameSize, proto.captureCount, proto.maxStack);
+    for (size_t i = 0; i < proto.code.size(); ++i) {
+      const Instruction word = proto.code[i];
+      const OpCode op = opcodeOf(word);
+      std::format_to(std::back_inserter(out), "  {:04} {:<12}", i, OpCode2String[static_cast<size_t>(op)]);
+      switch (op) {
+        case OpCode::Constant:
+          std::format_to(std::back_inserter(out), " {} ; {}", operandOf(word), module.constants[operandOf(word)]);
+          break;
+        case OpCode::Int:
+          std::format_to(std::back_inserter(out), " {}", immediateOf(word));
+          break;
+        case OpCode::LoadLocal: case OpCode::StoreLocal: case OpCode::LoadGlobal: case OpCode::StoreGlobal:
+        case OpCode::LoadCapture: case OpCode::NewBox: case OpCode::LoadBoxed: case OpCode::StoreBoxed:
+        case OpCode::LoadCaptureBoxed: case OpCode::StoreCaptureBoxed:
+        case OpCode::CoerceParam:
+          std::format_to(std::back_inserter(out), " {}:{}", operandOf(word) >> 8, operandOf(word) & 0xFF);
+          break;
+        case OpCode::TailCallDirect:
+          std::format_to(std::back_inserter(out), " {}:{}", operandOf(word) >> 4, operandOf(word) & 0xF);
+          break;
+        case OpCode::GetMember: case OpCode::SetMember:
+          std::format_to(std::back_inserter(out), " {} ; .{}", operandOf(word), symbolTable().name(module.memberSites[operandOf(word)].member));
+          break;
+        case OpCode::New: case OpCode::CheckClass:
+          std::format_to(std::back_inserter(out), " {} ; {}", operandOf(word), module.classes[operandOf(word)].name());
+          break;
+        case OpCode::CheckType: case OpCode::TailCall:
+        case OpCode::Jump: case OpCode::JumpIfFalse: case OpCode::Closure:
+        case OpCode::CallDirect:
+          std::format_to(std::back_inserter(out), " {}", operandOf(word));
+          break;
+        default:
+          break;
+      }
+      while (out.back() == ' ') out.pop_back();
+      out += '\n';
+    }
+  }
+  return out;
+}
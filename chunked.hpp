@@ -0,0 +1,86 @@
+# pragma once
+# include <algorithm>
+# include <string_view>
+# include <vector>
+
+# include "scan.hpp"
+# include "token.hpp"
+# include "threadpool.hpp"
+
+// 大きな1つのソースを文字列リテラルとコメントの外にある改行で分割し、チャンクごとに並列にトークン化する
+class ChunkedTokenizer {
+public:
+  // これより小さいチャンクには分けない
+  static constexpr size_t MinChunkSize = 1 << 16;
+  // srcは呼び出し側が保持する（トークンはsrcを参照するため）
+  explicit ChunkedTokenizer(std::string_view src) : m_source(src) {}
+
+  // トークンは各チャンクのTokenizerのアリーナも参照するため一時オブジェクトからは呼べない
+  TokenBuffer tokenize(ThreadPool& pool) & {
+    const size_t chunks = std::clamp<size_t>(m_source.length() / MinChunkSize, 1, pool.size());
+    const std::vector<size_t> bounds = split(m_source, chunks);
+    const size_t count = bounds.size() - 1;
+    m_tokenizers.clear();
+    m_tokenizers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      m_tokenizers.emplace_back(m_source.substr(bounds[i], bounds[i + 1] - bounds[i]));
+    }
+    std::vector<TokenBuffer> parts(count, TokenBuffer(""));
+    for (size_t i = 0; i < count; ++i) {
+      pool.submit([this, &parts, i] { parts[i] = m_tokenizers[i].buffer(); });
+    }
+    pool.wait();
+    // 位置をソース全体の位置へ直してつなげる（行と列は全体の行頭表から求まるので直す必要はない）
+    TokenBuffer tokens(m_source);
+    for (size_t i = 0; i < count; ++i) tokens.append(parts[i], bounds[i], i + 1 == count);
+    return tokens;
+  }
+  TokenBuffer tokenize(const size_t jobs) & {
+    ThreadPool pool(jobs);
+    return tokenize(pool);
+  }
+
+  // チャンクの境界（先頭0と末尾を含む）を求める
+  // 逐次のトークナイザはNULで読み終えるので、NUL以降はどのチャンクにも含めない
+  static std::vector<size_t> split(const std::string_view src, const size_t chunks) {
+    std::vector<size_t> bounds{0};
+    const size_t step = src.length() / chunks;
+    size_t target = step;
+    size_t length = src.length();
+    bool inString = false;
+    bool inComment = false;
+    const char* const end = src.data() + length;
+    for (size_t i = 0; i < length; ++i) {
+      i += scan::untilBoundary(src.data() + i, end);
+      if (i >= length) break;
+      const char c = src[i];
+      if (c == '\0') {
+        length = i;
+        break;
+      }
+      if (inString) {
+        // エスケープされた文字は読み飛ばす（NULは次の周回で扱う）
+        if (c == '\\' && i + 1 < length && src[i + 1] != '\0') ++i;
+        else if (c == '"') inString = false;
+        continue;
+      }
+      // コメントは改行で終わる
+      if (inComment && c != '\n') continue;
+      inComment = false;
+      if (c == '"') {
+        inString = true;
+      } else if (c == '/' && i + 1 < length && src[i + 1] == '/') {
+        inComment = true;
+        ++i;
+      } else if (c == '\n' && bounds.size() < chunks && i + 1 >= target && i + 1 < length) {
+        bounds.push_back(i + 1);
+        target = i + 1 + step;
+      }
+    }
+    bounds.push_back(length);
+    return bounds;
+  }
+private:
+  std::string_view m_source;
+  std::vector<Tokenizer> m_tokenizers;
+};
@@ -0,0 +1,578 @@
+# pragma once
+# include <map>
+# include <stdexcept>
+# include <unordered_map>
+# include <utility>
+# include <vector>
+
+# include "ast.hpp"
+# include "bytecode.hpp"
+
+// Resolver・TypeChecker済みのASTをバイトコードへ変換する
+// 静的に型が分かる演算は整数用・実数用の命令を選ぶ
+// カリー化された既知のfunkcioへの呼び出しの連鎖は、展開した多引数の関数への直接呼び出しにする
+class Compiler {
+public:
+  BytecodeModule compile(const ProgramNode& program) {
+    m_module = BytecodeModule{};
+    m_module.functions.emplace_back();
+    m_states.push_back(FunctionState{});
+    m_module.globalCount = program.frameSize;
+    m_module.types = program.types;
+    m_globalFunctions.assign(program.frameSize, nullptr);
+    m_specialized.clear();
+    m_classes.clear();
+    for (const ASTNode* stmt : program.statements) {
+      if (const auto* decl = nodeCast<VarDeclNode>(stmt)) m_module.globals.push_back({decl->name, decl->slot.index});
+      compileStatement(stmt);
+    }
+    emit(OpCode::Nil);
+    emit(OpCode::Return);
+    m_module.functions[0] = std::move(m_states.back().proto);
+    m_states.pop_back();
+    return std::move(m_module);
+  }
+private:
+  // コンパイル中の関数
+  // 展開した関数の1段分のスロットの対応
+  struct Level {
+    // 引数の位置と、それ以外のローカル変数の先頭
+    uint32_t param;
+    uint32_t offset;
+    const ArenaVector<Slot>* captures;
+  };
+  struct FunctionState {
+    FunctionProto proto;
+    uint32_t stackDepth = 0;
+    // funkcioの本体なら自分自身の宣言
+    const FunctionDeclNode* self = nullptr;
+    // funkcioで宣言されたローカル変数
+    std::unordered_map<uint32_t, const FunctionDeclNode*> localFunctions;
+    // 特殊化した関数ではコンパイル中の段と各段のスロットの対応
+    std::vector<Level> levels;
+    uint32_t level = 0;
+  };
+  // カリー化された関数の1段（引数1つの関数）
+  struct Stage {
+    const Type* paramType;
+    bool paramBoxed;
+    uint32_t frameSize;
+    const ArenaVector<Slot>* captures;
+    const ArenaVector<ASTNode*>* body;
+  };
+  BytecodeModule m_module;
+  std::vector<FunctionState> m_states;
+  // funkcioで宣言されたグローバル変数
+  std::vector<const FunctionDeclNode*> m_globalFunctions;
+  // (関数, 展開した段数)ごとの特殊化した関数の番号
+  std::map<std::pair<const FunctionDeclNode*, size_t>, uint32_t> m_specialized;
+  // klaso型ごとのklasoの番号
+  std::unordered_map<const Type*, uint32_t> m_classes;
+
+  static bool is(const Type* type, const TypeKind kind) {
+    return type && type->kind == kind;
+  }
+
+  FunctionState& state() {
+    return m_states.back();
+  }
+  // 命令のスタックへの増減
+  static int stackEffect(const OpCode op) {
+    switch (op) {
+      case OpCode::Constant: case OpCode::Int: case OpCode::True: case OpCode::False: case OpCode::Nil:
+      case OpCode::LoadLocal: case OpCode::LoadGlobal: case OpCode::LoadCapture: case OpCode::LoadSelf:
+      case OpCode::LoadBoxed: case OpCode::LoadCaptureBoxed:
+        return 1;
+      case OpCode::IntToReal: case OpCode::CoerceReal: case OpCode::CheckType: case OpCode::CheckClass: case OpCode::CoerceParam:
+      case OpCode::GetMember:
+      case OpCode::Jump: case OpCode::NoReturn:
+        return 0;
+      default:
+        // 二項演算・格納・Pop・条件ジャンプ・呼び出し・リターン（Closureは捕捉する数に応じて別に数える）
+        return -1;
+    }
+  }
+  size_t emit(const OpCode op, const uint32_t operand = 0) {
+    return emit(op, operand, stackEffect(op));
+  }
+  size_t emit(const OpCode op, const uint32_t operand, const int effect) {
+    if (operand > MaxOperand) throw std::runtime_error("Operand out of range");
+    FunctionState& s = state();
+    s.stackDepth += effect;
+    if (s.stackDepth > s.proto.maxStack) s.proto.maxStack = s.stackDepth;
+    s.proto.code.push_back(encode(op, operand));
+    return s.proto.code.size() - 1;
+  }
+  // ジャンプ先を現在位置に合わせる
+  void patch(const size_t at) {
+    const Instruction word = state().proto.code[at];
+    state().proto.code[at] = encode(opcodeOf(word), static_cast<uint32_t>(state().proto.code.size()));
+  }
+  // 文字列の定数はVMのGCで動かないようValue::permanentで作る
+  uint32_t constant(Value value) {
+    m_module.constants.push_back(std::move(value));
+    return static_cast<uint32_t>(m_module.constants.size() - 1);
+  }
+
+  // 特殊化した関数では各段のスロットを展開後のフレームの位置へ読み替える
+  Slot translate(const Slot slot) const {
+    const FunctionState& s = m_states.back();
+    return s.levels.empty() ? slot : translate(slot, s.level);
+  }
+  Slot translate(Slot slot, const uint32_t level) const {
+    const Level& l = m_states.back().levels[level];
+    switch (slot.storage) {
+      case Storage::Local:
+        slot.index = slot.index == 0 ? l.param : l.offset + slot.index - 1;
+        return slot;
+      case Storage::Capture: {
+        // 2段目以降の捕捉は1つ前の段の変数そのもの
+        if (level == 0) return slot;
+        Slot source = translate((*l.captures)[slot.index], level - 1);
+        source.boxed = slot.boxed;
+        return source;
+      }
+      default:
+        return slot;
+    }
+  }
+  void emitLoad(Slot slot) {
+    slot = translate(slot);
+    switch (slot.storage) {
+      case Storage::Local: emit(slot.boxed ? OpCode::LoadBoxed : OpCode::LoadLocal, slot.index); break;
+      case Storage::Global: emit(OpCode::LoadGlobal, slot.index); break;
+      case Storage::Capture: emit(slot.boxed ? OpCode::LoadCaptureBoxed : OpCode::LoadCapture, slot.index); break;
+      case Storage::Self: emit(OpCode::LoadSelf); break;
+    }
+  }
+  // 代入（捕捉された変数への代入は必ず箱を通る）
+  void emitStore(Slot slot) {
+    slot = translate(slot);
+    switch (slot.storage) {
+      case Storage::Local: emit(slot.boxed ? OpCode::StoreBoxed : OpCode::StoreLocal, slot.index); break;
+      case Storage::Global: emit(OpCode::StoreGlobal, slot.index); break;
+      case Storage::Capture: emit(OpCode::StoreCaptureBoxed, slot.index); break;
+      case Storage::Self: throw std::runtime_error("Cannot assign to funkcio");
+    }
+  }
+  // 宣言（箱に入れる変数は宣言のたびに新しい箱を作る）
+  void emitDeclare(Slot slot) {
+    slot = translate(slot);
+    if (slot.storage == Storage::Global) emit(OpCode::StoreGlobal, slot.index);
+    else emit(slot.boxed ? OpCode::NewBox : OpCode::StoreLocal, slot.index);
+  }
+  void emitDefault(const Type* type) {
+    switch (type->kind) {
+      case TypeKind::Entjera: emit(OpCode::Int, 0); break;
+      case TypeKind::Reala: emit(OpCode::Constant, constant(0.0)); break;
+      case TypeKind::Teksta: emit(OpCode::Constant, constant(std::string())); break;
+      case TypeKind::Bulea: emit(OpCode::False); break;
+      default: emit(OpCode::Nil); break;
+    }
+  }
+
+  // 関数本体を別のFunctionProtoへコンパイルする（namedは自分自身を参照できる関数）
+  uint32_t compileFunction(const FunctionDeclNode* named, const SymbolId name, const bool hasName, const Type* paramType, const bool paramBoxed,
+                           const uint32_t frameSize, const uint32_t captureCount, const ArenaVector<ASTNode*>& body) {
+    const uint32_t index = static_cast<uint32_t>(m_module.functions.size());
+    m_module.functions.emplace_back();
+    m_states.push_back(FunctionState{});
+    FunctionState& s = state();
+    s.proto.frameSize = frameSize;
+    s.proto.captureCount = captureCount;
+    s.proto.name = name;
+    s.proto.hasName = hasName;
+    s.self = named;
+    emitParam(0, paramType, paramBoxed);
+    for (const ASTNode* stmt : body) compileStatement(stmt);
+    emit(OpCode::NoReturn);
+    m_module.functions[index] = std::move(state().proto);
+    m_states.pop_back();
+    return index;
+  }
+  // 関数をコンパイルし、捕捉する値を積んでクロージャを作る
+  void compileClosure(const FunctionDeclNode* named, const Type* paramType, const bool paramBoxed,
+                      const uint32_t frameSize, const ArenaVector<Slot>& captures, const ArenaVector<ASTNode*>& body) {
+    const uint32_t index = compileFunction(named, named ? named->name : 0, named != nullptr, paramType, paramBoxed,
+                                           frameSize, static_cast<uint32_t>(captures.size()), body);
+    // 箱はそのまま、値はコピーして捕捉する
+    for (Slot source : captures) {
+      source = translate(source);
+      switch (source.storage) {
+        case Storage::Local: emit(OpCode::LoadLocal, source.index); break;
+        case Storage::Capture: emit(OpCode::LoadCapture, source.index); break;
+        case Storage::Self: emit(OpCode::LoadSelf); break;
+        case Storage::Global: throw std::runtime_error("Globals are never captured");
+      }
+    }
+    emit(OpCode::Closure, index, 1 - static_cast<int>(captures.size()));
+  }
+
+  // 静的に型の分からない呼び出しもあるので引数を宣言された型へ合わせる
+  void emitParam(const uint32_t slot, const Type* paramType, const bool paramBoxed) {
+    if (paramType) emit(OpCode::CoerceParam, slot << 8 | static_cast<uint32_t>(paramType->kind));
+    if (paramType && paramType->kind == TypeKind::Klaso) {
+      emit(OpCode::LoadLocal, slot);
+      emit(OpCode::CheckClass, classIndex(paramType));
+      emit(OpCode::Pop);
+    }
+    if (paramBoxed) {
+      emit(OpCode::LoadLocal, slot);
+      emit(OpCode::NewBox, slot);
+    }
+  }
+
+  // 副作用がなく例外も投げない式か（評価の順序を入れ替えても結果もエラーも変わらない）
+  // 変換は整数の実数化だけ、二項演算は型の検査をする汎用演算と0除算で投げうるので、静的に型の決まった
+  // 整数同士・実数同士の演算（オーバーフローは折り返す）のうち、整数の除算は除数が0でないリテラルのものだけ
+  static bool isPure(const ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::NumberLiteral: case NodeKind::StringLiteral: case NodeKind::BoolLiteral:
+      case NodeKind::VarRef: case NodeKind::AtFunction:
+        return true;
+      case NodeKind::Convert: {
+        const auto* convert = static_cast<const ConvertNode*>(node);
+        return convert->type->kind == TypeKind::Reala && is(convert->operand->type, TypeKind::Entjera) && isPure(convert->operand);
+      }
+      case NodeKind::BinaryOp: {
+        const auto* binary = static_cast<const BinaryOpNode*>(node);
+        const Type* left = binary->left->type;
+        const Type* right = binary->right->type;
+        const bool integer = is(left, TypeKind::Entjera) && is(right, TypeKind::Entjera);
+        if (!integer && !(is(left, TypeKind::Reala) && is(right, TypeKind::Reala))) return false;
+        if (integer && binary->op == BinaryOpNode::OpType::Div) {
+          const auto* divisor = nodeCast<NumberLiteral>(binary->right);
+          if (!divisor || divisor->integer == 0) return false;
+        }
+        return isPure(binary->left) && isPure(binary->right);
+      }
+      default:
+        return false;
+    }
+  }
+  // 本体が「自分のフレームだけを触る文; reveni @(...) {...};」ならその関数式を返す
+  // 展開すると後の引数を先に評価するので、前置きの文に副作用があれば展開しない
+  static const AtFunctionNode* curriedBody(const ArenaVector<ASTNode*>& body) {
+    if (body.empty() || body[body.size() - 1]->kind != NodeKind::Return) return nullptr;
+    const ExprNode* value = static_cast<const ReturnNode*>(body[body.size() - 1])->value;
+    if (value->kind != NodeKind::AtFunction) return nullptr;
+    for (size_t i = 0; i + 1 < body.size(); ++i) {
+      const ASTNode* stmt = body[i];
+      switch (stmt->kind) {
+        case NodeKind::VarDecl: {
+          const ExprNode* init = static_cast<const VarDeclNode*>(stmt)->initializer;
+          if (init && !isPure(init)) return nullptr;
+          break;
+        }
+        case NodeKind::Assign: {
+          const auto* assign = static_cast<const AssignNode*>(stmt);
+          if (assign->slot.storage != Storage::Local || !isPure(assign->value)) return nullptr;
+          break;
+        }
+        case NodeKind::FunctionDecl:
+          break;
+        default:
+          return nullptr;
+      }
+    }
+    return static_cast<const AtFunctionNode*>(value);
+  }
+  // 式が静的に分かるfunkcioを指していればその宣言を返す
+  const FunctionDeclNode* knownFunction(const ExprNode* node) {
+    if (node->kind != NodeKind::VarRef) return nullptr;
+    const Slot slot = translate(static_cast<const VarRefNode*>(node)->slot);
+    switch (slot.storage) {
+      case Storage::Global: return m_globalFunctions[slot.index];
+      case Storage::Self: return state().self;
+      case Storage::Local: {
+        const auto iter = state().localFunctions.find(slot.index);
+        return iter == state().localFunctions.end() ? nullptr : iter->second;
+      }
+      default: return nullptr;
+    }
+  }
+  // tailなら末尾呼び出しにする（checkは戻り値の変換でTypeKind+1、0なら変換なし）
+  void compileCall(const CallNode* call, const bool tail = false, const uint32_t check = 0) {
+    if (compileCurriedCall(call, tail, check)) return;
+    compileExpression(call->function);
+    compileExpression(call->argument);
+    emitCall(tail, check);
+  }
+  // 変換のある末尾呼び出しは、できなかったときのために戻り値をスタックに残す扱いにする
+  void emitCall(const bool tail, const uint32_t check) {
+    if (!tail) emit(OpCode::Call);
+    else emit(OpCode::TailCall, check, check ? -1 : -2);
+  }
+  // f(a)(b)...の連鎖を展開できればCallDirectで呼び出す
+  bool compileCurriedCall(const CallNode* call, const bool tail, const uint32_t check) {
+    std::vector<const ExprNode*> arguments;
+    const ExprNode* callee = call;
+    while (callee->kind == NodeKind::Call) {
+      arguments.push_back(static_cast<const CallNode*>(callee)->argument);
+      callee = static_cast<const CallNode*>(callee)->function;
+    }
+    if (arguments.size() < 2) return false;
+    const FunctionDeclNode* func = knownFunction(callee);
+    if (!func) return false;
+    std::vector<Stage> stages{Stage{func->paramType, func->paramBoxed, func->frameSize, &func->captures, &func->body}};
+    while (stages.size() < arguments.size()) {
+      const AtFunctionNode* next = curriedBody(*stages.back().body);
+      if (!next) break;
+      stages.push_back(Stage{next->paramType, next->paramBoxed, next->frameSize, &next->captures, &next->body});
+    }
+    if (stages.size() < 2) return false;
+    const uint32_t index = specialize(func, stages);
+    // 引数は内側の呼び出しから順に並んでいる
+    compileExpression(callee);
+    for (size_t i = 0; i < stages.size(); ++i) compileExpression(arguments[arguments.size() - 1 - i]);
+    const bool direct = stages.size() == arguments.size();
+    const int count = static_cast<int>(stages.size());
+    if (tail && direct) emit(OpCode::TailCallDirect, index << 4 | check, check ? -count : -count - 1);
+    else emit(OpCode::CallDirect, index, -count);
+    // 展開しきれなかった残りの引数は通常の呼び出し
+    for (size_t i = stages.size(); i < arguments.size(); ++i) {
+      compileExpression(arguments[arguments.size() - 1 - i]);
+      emitCall(tail && i + 1 == arguments.size(), check);
+    }
+    return true;
+  }
+  // 各段の本体をつなげた多引数の関数を作る（引数はスロット0から段の順に並べる）
+  uint32_t specialize(const FunctionDeclNode* func, const std::vector<Stage>& stages) {
+    const auto key = std::make_pair(func, stages.size());
+    const auto iter = m_specialized.find(key);
+    if (iter != m_specialized.end()) return iter->second;
+    const uint32_t index = static_cast<uint32_t>(m_module.functions.size());
+    m_module.functions.emplace_back();
+    // 再帰呼び出しから同じ特殊化を引けるよう先に登録する
+    m_specialized.emplace(key, index);
+    m_states.push_back(FunctionState{});
+    FunctionState& s = state();
+    s.proto.name = func->name;
+    s.proto.hasName = true;
+    s.proto.arity = static_cast<uint32_t>(stages.size());
+    s.proto.captureCount = static_cast<uint32_t>(func->captures.size());
+    s.self = func;
+    uint32_t offset = s.proto.arity;
+    for (uint32_t i = 0; i < stages.size(); ++i) {
+      s.levels.push_back(Level{i, offset, stages[i].captures});
+      offset += stages[i].frameSize - 1;
+    }
+    s.proto.frameSize = offset;
+    for (uint32_t i = 0; i < stages.size(); ++i) {
+      state().level = i;
+      emitParam(i, stages[i].paramType, stages[i].paramBoxed);
+      // 最後の段以外は次の段を返すreveniを除いた前置きだけを実行する
+      const ArenaVector<ASTNode*>& body = *stages[i].body;
+      const size_t count = i + 1 < stages.size() ? body.size() - 1 : body.size();
+      for (size_t j = 0; j < count; ++j) compileStatement(body[j]);
+    }
+    emit(OpCode::NoReturn);
+    m_module.functions[index] = std::move(state().proto);
+    m_states.pop_back();
+    return index;
+  }
+
+  void compileBlock(const ArenaVector<ASTNode*>& body) {
+    for (const ASTNode* stmt : body) compileStatement(stmt);
+  }
+  void compileStatement(const ASTNode* node) {
+    switch (node->kind) {
+      case NodeKind::VarDecl: {
+        const auto* decl = static_cast<const VarDeclNode*>(node);
+        if (decl->initializer) compileExpression(decl->initializer);
+        else if (decl->type->kind == TypeKind::Klaso) emitNew(decl->type);
+        else emitDefault(decl->type);
+        emitDeclare(decl->slot);
+        break;
+      }
+      case NodeKind::Assign: {
+        const auto* assign = static_cast<const AssignNode*>(node);
+        compileExpression(assign->value);
+        emitStore(assign->slot);
+        break;
+      }
+      case NodeKind::MemberAssign: {
+        const auto* assign = static_cast<const MemberAssignNode*>(node);
+        compileExpression(assign->object);
+        compileExpression(assign->value);
+        emit(OpCode::SetMember, memberSite(assign->object->type, assign->member), -2);
+        break;
+      }
+      case NodeKind::FunctionDecl: {
+        const auto* func = static_cast<const FunctionDeclNode*>(node);
+        // 本体からの再帰呼び出しも展開できるよう先に登録する
+        const Slot slot = translate(func->slot);
+        if (slot.storage == Storage::Global) m_globalFunctions[slot.index] = func;
+        else state().localFunctions[slot.index] = func;
+        compileClosure(func, func->paramType, func->paramBoxed, func->frameSize, func->captures, func->body);
+        emitDeclare(func->slot);
+        break;
+      }
+      case NodeKind::Return: {
+        // 関数の中で呼び出しの結果を返すなら現在のフレームを再利用する（戻り値の変換は呼び出し後に行う）
+        const ExprNode* value = static_cast<const ReturnNode*>(node)->value;
+        const auto* convert = nodeCast<ConvertNode>(value);
+        const ExprNode* returned = convert ? convert->operand : value;
+        // VMが持ち越せる変換はTypeKindだけなのでklasoへの変換は末尾呼び出しにしない
+        const bool klass = convert && convert->type->kind == TypeKind::Klaso;
+        if (returned->kind == NodeKind::Call && m_states.size() > 1 && !klass) {
+          compileCall(static_cast<const CallNode*>(returned), true, convert ? static_cast<uint32_t>(convert->type->kind) + 1 : 0);
+          // 変換が重なって末尾呼び出しにできなかったときは通常どおり変換して返す
+          if (!convert) break;
+          emitConvert(convert);
+        } else {
+          compileExpression(value);
+        }
+        emit(OpCode::Return);
+        break;
+      }
+      case NodeKind::If: {
+        const auto* ifNode = static_cast<const IfNode*>(node);
+        compileExpression(ifNode->condition);
+        const size_t toElse = emit(OpCode::JumpIfFalse);
+        compileBlock(ifNode->thenBody);
+        if (ifNode->elseBody.empty()) {
+          patch(toElse);
+          break;
+        }
+        const size_t toEnd = emit(OpCode::Jump);
+        patch(toElse);
+        compileBlock(ifNode->elseBody);
+        patch(toEnd);
+        break;
+      }
+      case NodeKind::While: {
+        const auto* whileNode = static_cast<const WhileNode*>(node);
+        const uint32_t start = static_cast<uint32_t>(state().proto.code.size());
+        compileExpression(whileNode->condition);
+        const size_t toEnd = emit(OpCode::JumpIfFalse);
+        compileBlock(whileNode->body);
+        emit(OpCode::Jump, start);
+        patch(toEnd);
+        break;
+      }
+      case NodeKind::Block:
+        compileBlock(static_cast<const BlockNode*>(node)->body);
+        break;
+      case NodeKind::ClassDecl:
+        compileClass(static_cast<const ClassDeclNode*>(node));
+        break;
+      default:
+        compileExpression(static_cast<const ExprNode*>(node));
+        emit(OpCode::Pop);
+    }
+  }
+
+  void compileExpression(const ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::NumberLiteral: {
+        const auto* number = static_cast<const NumberLiteral*>(node);
+        if (!number->isInteger) emit(OpCode::Constant, constant(number->real));
+        else if (number->integer >= -(1 << 23) && number->integer < (1 << 23)) emit(OpCode::Int, static_cast<uint32_t>(number->integer) & MaxOperand);
+        else emit(OpCode::Constant, constant(number->integer));
+        break;
+      }
+      case NodeKind::StringLiteral:
+        emit(OpCode::Constant, constant(Value::permanent(static_cast<const StringLiteral*>(node)->value)));
+        break;
+      case NodeKind::BoolLiteral:
+        emit(static_cast<const BoolLiteral*>(node)->value ? OpCode::True : OpCode::False);
+        break;
+      case NodeKind::VarRef:
+        emitLoad(static_cast<const VarRefNode*>(node)->slot);
+        break;
+      case NodeKind::BinaryOp:
+        compileBinary(static_cast<const BinaryOpNode*>(node));
+        break;
+      case NodeKind::Call:
+        compileCall(static_cast<const CallNode*>(node));
+        break;
+      case NodeKind::AtFunction: {
+        const auto* atFunc = static_cast<const AtFunctionNode*>(node);
+        compileClosure(nullptr, atFunc->paramType, atFunc->paramBoxed, atFunc->frameSize, atFunc->captures, atFunc->body);
+        break;
+      }
+      case NodeKind::Convert: {
+        const auto* convert = static_cast<const ConvertNode*>(node);
+        compileExpression(convert->operand);
+        emitConvert(convert);
+        break;
+      }
+      case NodeKind::MemberAccess: {
+        const auto* member = static_cast<const MemberAccessNode*>(node);
+        compileExpression(member->object);
+        emit(OpCode::GetMember, memberSite(member->object->type, member->member));
+        break;
+      }
+      default:
+        throw std::runtime_error("Unknown expression");
+    }
+  }
+  void emitConvert(const ConvertNode* convert) {
+    if (convert->type->kind == TypeKind::Klaso) emit(OpCode::CheckClass, classIndex(convert->type));
+    else if (convert->type->kind != TypeKind::Reala) emit(OpCode::CheckType, static_cast<uint32_t>(convert->type->kind));
+    else if (is(convert->operand->type, TypeKind::Entjera)) emit(OpCode::IntToReal);
+    else emit(OpCode::CoerceReal);
+  }
+  // メソッドはtiuだけを捕捉する関数として、宣言の箇所で一度だけコンパイルする
+  void compileClass(const ClassDeclNode* node) {
+    const uint32_t index = static_cast<uint32_t>(m_module.classes.size());
+    m_module.classes.emplace_back(node);
+    m_classes.emplace(node->type, index);
+    std::vector<uint32_t> methods;
+    for (const FunctionDeclNode* method : node->methods) {
+      methods.push_back(compileFunction(nullptr, method->name, true, method->paramType, method->paramBoxed,
+                                        method->frameSize, static_cast<uint32_t>(method->captures.size()), method->body));
+    }
+    m_module.classes[index].methods = std::move(methods);
+  }
+  uint32_t classIndex(const Type* type) const {
+    const auto iter = m_classes.find(type);
+    if (iter == m_classes.end()) throw std::runtime_error("Unknown klaso " + type->toString());
+    return iter->second;
+  }
+  // フィールドの初期化式（初期化式のないklaso型のフィールドは無効値）を積んでインスタンスを作る
+  void emitNew(const Type* type) {
+    const uint32_t index = classIndex(type);
+    const ClassDeclNode* node = m_module.classes[index].decl;
+    for (const VarDeclNode* field : node->fields) {
+      if (field->initializer) compileExpression(field->initializer);
+      else emitDefault(field->type);
+    }
+    emit(OpCode::New, index, 1 - static_cast<int>(node->fields.size()));
+  }
+  // 静的に型が分かるアクセスはキャッシュをそのklasoで埋めておく
+  uint32_t memberSite(const Type* object, const SymbolId member) {
+    MemberSite site{member, -1, 0};
+    if (object && object->kind == TypeKind::Klaso) {
+      const uint32_t index = classIndex(object);
+      site.klass = static_cast<int32_t>(index);
+      site.index = static_cast<uint32_t>(m_module.classes[index].find(member));
+    }
+    m_module.memberSites.push_back(site);
+    return static_cast<uint32_t>(m_module.memberSites.size() - 1);
+  }
+  // 被演算子の型はTypeCheckerがそろえている
+  void compileBinary(const BinaryOpNode* node) {
+    using OpType = BinaryOpNode::OpType;
+    compileExpression(node->left);
+    compileExpression(node->right);
+    const Type* left = node->left->type;
+    const Type* right = node->right->type;
+    const auto index = static_cast<uint32_t>(node->op);
+    if (is(left, TypeKind::Entjera) && is(right, TypeKind::Entjera)) {
+      emit(static_cast<OpCode>(static_cast<uint32_t>(OpCode::AddInt) + index));
+    } else if (is(left, TypeKind::Reala) && is(right, TypeKind::Reala)) {
+      emit(static_cast<OpCode>(static_cast<uint32_t>(OpCode::AddReal) + index));
+    } else if (node->op == OpType::Add && is(left, TypeKind::Teksta) && is(right, TypeKind::Teksta)) {
+      emit(OpCode::Concat);
+    } else {
+      emit(static_cast<OpCode>(static_cast<uint32_t>(OpCode::Add) + index));
+    }
+  }
+};
+
+// 演算子の並びが命令の並びと一致していることを確認
+static_assert(static_cast<int>(OpCode::GeInt) - static_cast<int>(OpCode::AddInt) == static_cast<int>(BinaryOpNode::OpType::GE));
+static_assert(static_cast<int>(OpCode::GeReal) - static_cast<int>(OpCode::AddReal) == static_cast<int>(BinaryOpNode::OpType::GE));
+static_assert(static_cast<int>(OpCode::Ge) - static_cast<int>(OpCode::Add) == static_cast<int>(BinaryOpNode::OpType::GE));
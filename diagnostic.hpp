@@ -0,0 +1,26 @@
+# pragma once
+# include <cstdint>
+# include <format>
+# include <string>
+
+// 構文エラーなどの診断
+struct Diagnostic {
+  std::string message;
+  // 問題のあるトークンの行と列（列は1始まり）
+  int line;
+  int column;
+  // 問題のあるトークンのソース上の先頭位置と長さ
+  uint32_t offset;
+  uint32_t length;
+};
+
+// 「行:列: メッセージ」の形で書く
+template<>
+struct std::formatter<Diagnostic> {
+  constexpr auto parse(std::format_parse_context& ctx) {
+    return ctx.begin();
+  }
+  auto format(const Diagnostic& diagnostic, std::format_context& ctx) const {
+    return std::format_to(ctx.out(), "{}:{}: {}", diagnostic.line, diagnostic.column, diagnostic.message);
+  }
+};
@@ -0,0 +1,87 @@
+# pragma once
+# include <algorithm>
+# include <filesystem>
+# include <format>
+# include <memory>
+# include <optional>
+# include <string>
+# include <vector>
+
+# include "astcache.hpp"
+# include "source.hpp"
+# include "parser.hpp"
+# include "threadpool.hpp"
+
+// 1ファイル分の解析結果（失敗した場合はprogramが空でdiagnosticにエラー内容が入る。構文エラーは1行に1つ）
+struct ParsedFile {
+  std::string path;
+  std::shared_ptr<ProgramNode> program;
+  std::string diagnostic;
+  // AstCacheから読み込んだか
+  bool cached = false;
+};
+
+// 複数のソースをスレッドプール上でトークン化・構文解析する
+class Driver {
+public:
+  explicit Driver(const size_t jobs = std::thread::hardware_concurrency()) : m_jobs(jobs) {}
+  // 構文解析の結果をdirectoryにキャッシュし、内容が変わっていないファイルの再解析を省く
+  void useCache(const std::filesystem::path& directory) {
+    m_cache.emplace(directory);
+  }
+  // ディレクトリは再帰的にたどって.esperoファイルを集める（順序はパス順に揃える）
+  static std::vector<std::string> collect(const std::vector<std::string>& inputs) {
+    std::vector<std::string> paths;
+    for (const std::string& input : inputs) {
+      if (!std::filesystem::is_directory(input)) {
+        paths.push_back(input);
+        continue;
+      }
+      std::vector<std::string> found;
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".espero") {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::ranges::sort(found);
+      paths.insert(paths.end(), found.begin(), found.end());
+    }
+    return paths;
+  }
+  // 結果は入力と同じ順に並ぶ
+  std::vector<ParsedFile> parse(const std::vector<std::string>& paths) const {
+    std::vector<ParsedFile> results(paths.size());
+    ThreadPool pool(std::min(m_jobs, std::max<size_t>(paths.size(), 1)));
+    for (size_t i = 0; i < paths.size(); ++i) {
+      results[i].path = paths[i];
+      pool.submit([this, &result = results[i]] { parseFile(result); });
+    }
+    pool.wait();
+    return results;
+  }
+private:
+  size_t m_jobs;
+  std::optional<AstCache> m_cache;
+  void parseFile(ParsedFile& result) const {
+    try {
+      const SourceFile source(result.path);
+      const uint64_t hash = m_cache ? contentHash(source.view()) : 0;
+      if (m_cache && (result.program = m_cache->load(source.view(), hash))) {
+        result.cached = true;
+        return;
+      }
+      Parser parser(source.view());
+      std::shared_ptr<ProgramNode> program = parser.parse();
+      // 構文エラーは1行に1つずつ並べる
+      for (const Diagnostic& diagnostic : parser.diagnostics()) {
+        if (!result.diagnostic.empty()) result.diagnostic += '\n';
+        result.diagnostic += std::format("{}:{}", result.path, diagnostic);
+      }
+      if (!parser.diagnostics().empty()) return;
+      result.program = std::move(program);
+      if (m_cache) m_cache->store(*result.program, source.view(), hash);
+    } catch (const std::exception& err) {
+      result.diagnostic = std::format("{}: {}", result.path, err.what());
+    }
+  }
+};
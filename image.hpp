@@ -0,0 +1,401 @@
+# pragma once
+# include <array>
+# include <bit>
+# include <cstdint>
+# include <cstring>
+# include <filesystem>
+# include <fstream>
+# include <memory>
+# include <stdexcept>
+# include <string>
+# include <string_view>
+# include <unordered_map>
+# include <vector>
+
+# include "bytecode.hpp"
+# include "source.hpp"
+
+// コンパイル済みのBytecodeModuleを保存する.esperocイメージの形式
+// ヘッダ | 文字列の開始位置[stringCount + 1] | 文字列本体 | 型 | 定数 | 関数 | 命令 | klaso | メンバー | アクセス箇所 | トップレベルの変数
+// 読み込みはmmapしたファイルを先頭から1回なぞるだけで、トークン化・構文解析・コンパイルを行わない
+// 数値は書き込んだ環境のバイト順のまま置く
+namespace imagefile {
+  constexpr std::array<char, 8> Magic = {'E', 'S', 'P', 'E', 'R', 'O', 'C', '\0'};
+  constexpr uint32_t Version = 1;
+  // 名前がないことを表す番号
+  constexpr uint32_t None = UINT32_MAX;
+
+  struct Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t typeCount;
+    uint32_t constantCount;
+    uint32_t functionCount;
+    uint32_t codeCount;
+    uint32_t classCount;
+    uint32_t memberCount;
+    uint32_t memberSiteCount;
+    uint32_t globalNameCount;
+    // トップレベルの変数の領域の大きさ
+    uint32_t globalCount;
+  };
+  // kindと、関数型なら引数と戻り値の型の番号、klasoなら名前の文字列の番号
+  struct TypeRecord {
+    uint8_t kind;
+    uint8_t padding[3];
+    uint32_t a;
+    uint32_t b;
+  };
+  // Valueの添字と、数値と真偽値はそのビット列、文字列は文字列の番号
+  struct ConstantRecord {
+    uint8_t index;
+    uint8_t padding[7];
+    uint64_t bits;
+  };
+  // 命令は命令の区間のcodeStartからcodeCount語
+  struct FunctionRecord {
+    uint32_t name;
+    uint32_t arity;
+    uint32_t frameSize;
+    uint32_t captureCount;
+    uint32_t maxStack;
+    uint32_t codeStart;
+    uint32_t codeCount;
+  };
+  // メンバーはメンバーの区間のmemberStartから、フィールドfieldCount個に続いてメソッドが並ぶ
+  struct ClassRecord {
+    uint32_t name;
+    uint32_t fieldCount;
+    uint32_t memberStart;
+    uint32_t memberCount;
+  };
+  // フィールドならvalueは型の番号、メソッドなら関数の番号
+  struct MemberRecord {
+    uint32_t name;
+    uint32_t value;
+  };
+  struct MemberSiteRecord {
+    uint32_t member;
+    int32_t klass;
+    uint32_t index;
+  };
+  struct GlobalRecord {
+    uint32_t name;
+    uint32_t slot;
+  };
+  static_assert(sizeof(Header) == 56 && sizeof(ConstantRecord) == 16 && sizeof(FunctionRecord) == 28);
+
+  constexpr size_t align(const size_t size) {
+    return (size + 7) & ~size_t{7};
+  }
+}
+
+// BytecodeModuleを.esperocイメージへ書き出す
+class ImageWriter {
+public:
+  std::string write(const BytecodeModule& module) {
+    for (const Value& value : module.constants) constant(value);
+    std::vector<uint32_t> code;
+    for (const FunctionProto& proto : module.functions) {
+      m_functions.push_back({proto.hasName ? symbol(proto.name) : imagefile::None, proto.arity, proto.frameSize, proto.captureCount,
+                             proto.maxStack, static_cast<uint32_t>(code.size()), static_cast<uint32_t>(proto.code.size())});
+      code.insert(code.end(), proto.code.begin(), proto.code.end());
+    }
+    for (const ClassInfo& klass : module.classes) {
+      m_classes.push_back({symbol(klass.className), klass.fieldCount, static_cast<uint32_t>(m_members.size()), static_cast<uint32_t>(klass.members.size())});
+      for (uint32_t i = 0; i < klass.members.size(); ++i) {
+        const uint32_t value = i < klass.fieldCount ? type(klass.fieldTypes[i]) : klass.methods[i - klass.fieldCount];
+        m_members.push_back({symbol(klass.members[i]), value});
+      }
+    }
+    for (const MemberSite& site : module.memberSites) m_sites.push_back({symbol(site.member), site.klass, site.index});
+    for (const GlobalName& global : module.globals) m_globals.push_back({symbol(global.name), global.slot});
+
+    imagefile::Header header{};
+    header.magic = imagefile::Magic;
+    header.version = imagefile::Version;
+    std::vector<uint32_t> offsets{0};
+    for (const std::string& str : m_strings) offsets.push_back(offsets.back() + static_cast<uint32_t>(str.length()));
+    header.stringCount = static_cast<uint32_t>(m_strings.size());
+    header.stringBytes = offsets.back();
+    header.typeCount = static_cast<uint32_t>(m_types.size());
+    header.constantCount = static_cast<uint32_t>(m_constants.size());
+    header.functionCount = static_cast<uint32_t>(m_functions.size());
+    header.codeCount = static_cast<uint32_t>(code.size());
+    header.classCount = static_cast<uint32_t>(m_classes.size());
+    header.memberCount = static_cast<uint32_t>(m_members.size());
+    header.memberSiteCount = static_cast<uint32_t>(m_sites.size());
+    header.globalNameCount = static_cast<uint32_t>(m_globals.size());
+    header.globalCount = module.globalCount;
+    std::string out;
+    append(out, &header, sizeof(header));
+    append(out, offsets.data(), offsets.size() * sizeof(uint32_t));
+    for (const std::string& str : m_strings) out.append(str);
+    out.resize(imagefile::align(out.size()), '\0');
+    append(out, m_types);
+    append(out, m_constants);
+    append(out, m_functions);
+    append(out, code);
+    append(out, m_classes);
+    append(out, m_members);
+    append(out, m_sites);
+    append(out, m_globals);
+    return out;
+  }
+private:
+  std::vector<std::string> m_strings;
+  std::unordered_map<std::string, uint32_t> m_stringIds;
+  std::vector<imagefile::TypeRecord> m_types;
+  std::unordered_map<const Type*, uint32_t> m_typeIds;
+  std::vector<imagefile::ConstantRecord> m_constants;
+  std::vector<imagefile::FunctionRecord> m_functions;
+  std::vector<imagefile::ClassRecord> m_classes;
+  std::vector<imagefile::MemberRecord> m_members;
+  std::vector<imagefile::MemberSiteRecord> m_sites;
+  std::vector<imagefile::GlobalRecord> m_globals;
+
+  static void append(std::string& out, const void* data, const size_t size) {
+    out.append(static_cast<const char*>(data), size);
+  }
+  template<typename T>
+  static void append(std::string& out, const std::vector<T>& records) {
+    append(out, records.data(), records.size() * sizeof(T));
+  }
+  uint32_t string(const std::string_view str) {
+    const auto [iter, inserted] = m_stringIds.try_emplace(std::string(str), static_cast<uint32_t>(m_strings.size()));
+    if (inserted) m_strings.emplace_back(str);
+    return iter->second;
+  }
+  uint32_t symbol(const SymbolId id) {
+    return string(symbolTable().name(id));
+  }
+  uint32_t type(const Type* type) {
+    const auto iter = m_typeIds.find(type);
+    if (iter != m_typeIds.end()) return iter->second;
+    imagefile::TypeRecord record{};
+    record.kind = static_cast<uint8_t>(type->kind);
+    record.a = record.b = imagefile::None;
+    if (type->kind == TypeKind::Funkcia && type->paramType && type->returnType) {
+      record.a = this->type(type->paramType);
+      record.b = this->type(type->returnType);
+    } else if (type->kind == TypeKind::Klaso) {
+      record.a = string(type->className);
+    }
+    const auto index = static_cast<uint32_t>(m_types.size());
+    m_types.push_back(record);
+    m_typeIds.emplace(type, index);
+    return index;
+  }
+  void constant(const Value& value) {
+    imagefile::ConstantRecord record{};
+    record.index = static_cast<uint8_t>(value.kind());
+    switch (value.kind()) {
+      case ValueKind::Nil: break;
+      case ValueKind::Int: record.bits = std::bit_cast<uint64_t>(value.asInt()); break;
+      case ValueKind::Real: record.bits = std::bit_cast<uint64_t>(value.asReal()); break;
+      case ValueKind::Bool: record.bits = value.asBool(); break;
+      case ValueKind::String: record.bits = string(value.asString()); break;
+      // コンパイラが定数にするのはリテラルの値だけ
+      default: throw std::runtime_error("Cannot write a runtime value to an image");
+    }
+    m_constants.push_back(record);
+  }
+};
+
+// .esperocイメージからBytecodeModuleを組み立てる
+// 表の番号、ジャンプ先、ローカル変数・捕捉した変数・トップレベルの変数の位置、型の番号を検査し、不正なら例外を投げる
+// （スタックの深さなどそれ以外はイメージを書いたコンパイラを信頼する）
+class ImageReader {
+public:
+  static BytecodeModule read(const std::string_view data) {
+    return ImageReader(data).build();
+  }
+private:
+  std::string_view m_data;
+  imagefile::Header m_header{};
+  size_t m_offset = 0;
+  size_t m_strings = 0;
+  std::vector<uint32_t> m_stringOffsets;
+  BytecodeModule m_module;
+  std::vector<SymbolId> m_symbols;
+  std::vector<const Type*> m_types;
+
+  explicit ImageReader(const std::string_view data) : m_data(data) {}
+  [[noreturn]] static void invalid() {
+    throw std::runtime_error("Invalid bytecode image");
+  }
+  template<typename T>
+  T load(const size_t offset) const {
+    T value;
+    std::memcpy(&value, m_data.data() + offset, sizeof(T));
+    return value;
+  }
+  // 次の区間を読む（区間はファイルの中に収まっていなければならない）
+  template<typename T>
+  std::vector<T> section(const uint32_t count) {
+    const uint64_t size = uint64_t{count} * sizeof(T);
+    if (m_offset + size > m_data.length()) invalid();
+    std::vector<T> records(count);
+    if (size > 0) std::memcpy(records.data(), m_data.data() + m_offset, size);
+    m_offset += size;
+    return records;
+  }
+  BytecodeModule build() {
+    if (m_data.length() < sizeof(imagefile::Header)) invalid();
+    m_header = load<imagefile::Header>(0);
+    if (m_header.magic != imagefile::Magic || m_header.version != imagefile::Version) invalid();
+    m_offset = sizeof(imagefile::Header);
+    if (m_header.stringCount == UINT32_MAX) invalid();
+    m_stringOffsets = section<uint32_t>(m_header.stringCount + 1);
+    if (m_stringOffsets.front() != 0 || m_stringOffsets.back() != m_header.stringBytes) invalid();
+    for (size_t i = 1; i < m_stringOffsets.size(); ++i) {
+      if (m_stringOffsets[i - 1] > m_stringOffsets[i]) invalid();
+    }
+    m_strings = m_offset;
+    m_offset = imagefile::align(m_offset + m_header.stringBytes);
+    if (m_offset > m_data.length()) invalid();
+    m_symbols.assign(m_header.stringCount, imagefile::None);
+
+    m_module.types = std::make_shared<TypeContext>();
+    const auto types = section<imagefile::TypeRecord>(m_header.typeCount);
+    for (uint32_t i = 0; i < types.size(); ++i) m_types.push_back(readType(types[i], i));
+    for (const imagefile::ConstantRecord& record : section<imagefile::ConstantRecord>(m_header.constantCount)) {
+      m_module.constants.push_back(readConstant(record));
+    }
+    const auto functions = section<imagefile::FunctionRecord>(m_header.functionCount);
+    const auto code = section<uint32_t>(m_header.codeCount);
+    for (const imagefile::FunctionRecord& record : functions) {
+      if (uint64_t{record.codeStart} + record.codeCount > code.size()) invalid();
+      FunctionProto& proto = m_module.functions.emplace_back();
+      proto.hasName = record.name != imagefile::None;
+      proto.name = proto.hasName ? symbol(record.name) : 0;
+      proto.arity = record.arity;
+      proto.frameSize = record.frameSize;
+      proto.captureCount = record.captureCount;
+      proto.maxStack = record.maxStack;
+      proto.code.assign(code.begin() + record.codeStart, code.begin() + record.codeStart + record.codeCount);
+    }
+    if (m_module.functions.empty()) invalid();
+    const auto classes = section<imagefile::ClassRecord>(m_header.classCount);
+    const auto members = section<imagefile::MemberRecord>(m_header.memberCount);
+    for (const imagefile::ClassRecord& record : classes) {
+      if (uint64_t{record.memberStart} + record.memberCount > members.size() || record.fieldCount > record.memberCount) invalid();
+      const SymbolId name = symbol(record.name);
+      std::vector<SymbolId> names;
+      std::vector<const Type*> fieldTypes;
+      std::vector<uint32_t> methods;
+      for (uint32_t i = 0; i < record.memberCount; ++i) {
+        const imagefile::MemberRecord& member = members[record.memberStart + i];
+        names.push_back(symbol(member.name));
+        if (i < record.fieldCount) fieldTypes.push_back(type(member.value));
+        else if (member.value < m_module.functions.size()) methods.push_back(member.value);
+        else invalid();
+      }
+      m_module.classes.emplace_back(name, m_module.types->klass(string(record.name)), std::move(names), std::move(fieldTypes), std::move(methods));
+    }
+    for (const imagefile::MemberSiteRecord& record : section<imagefile::MemberSiteRecord>(m_header.memberSiteCount)) {
+      if (record.klass >= 0 && (static_cast<uint32_t>(record.klass) >= m_module.classes.size()
+                                || record.index >= m_module.classes[record.klass].members.size())) invalid();
+      m_module.memberSites.push_back({symbol(record.member), record.klass, record.index});
+    }
+    m_module.globalCount = m_header.globalCount;
+    for (const imagefile::GlobalRecord& record : section<imagefile::GlobalRecord>(m_header.globalNameCount)) {
+      if (record.slot >= m_module.globalCount) invalid();
+      m_module.globals.push_back({symbol(record.name), record.slot});
+    }
+    if (m_offset != m_data.length()) invalid();
+    for (const FunctionProto& proto : m_module.functions) verify(proto);
+    return std::move(m_module);
+  }
+  std::string_view string(const uint64_t i) const {
+    if (i >= m_header.stringCount) invalid();
+    return m_data.substr(m_strings + m_stringOffsets[i], m_stringOffsets[i + 1] - m_stringOffsets[i]);
+  }
+  // 同じ文字列のinternは1回だけ行う
+  SymbolId symbol(const uint32_t i) {
+    const std::string_view name = string(i);
+    if (m_symbols[i] == imagefile::None) m_symbols[i] = symbolTable().intern(name);
+    return m_symbols[i];
+  }
+  const Type* type(const uint32_t i) const {
+    if (i >= m_types.size()) invalid();
+    return m_types[i];
+  }
+  const Type* readType(const imagefile::TypeRecord& record, const uint32_t self) {
+    if (record.kind > static_cast<uint8_t>(TypeKind::Void)) invalid();
+    const auto kind = static_cast<TypeKind>(record.kind);
+    if (kind == TypeKind::Klaso) return m_module.types->klass(string(record.a));
+    if (kind == TypeKind::Funkcia && record.a != imagefile::None) {
+      // 型は参照先より後ろに並ぶ
+      if (record.a >= self || record.b >= self) invalid();
+      return m_module.types->function(type(record.a), type(record.b));
+    }
+    return TypeContext::primitive(kind);
+  }
+  Value readConstant(const imagefile::ConstantRecord& record) const {
+    switch (static_cast<ValueKind>(record.index)) {
+      case ValueKind::Nil: return Value();
+      case ValueKind::Int: return std::bit_cast<int64_t>(record.bits);
+      case ValueKind::Real: return std::bit_cast<double>(record.bits);
+      case ValueKind::Bool: return record.bits != 0;
+      case ValueKind::String: return Value::permanent(string(record.bits));
+      default: break;
+    }
+    invalid();
+  }
+  // 命令のオペランドが指す先が存在することを確かめる
+  void verify(const FunctionProto& proto) const {
+    constexpr auto OpCodeCount = static_cast<uint32_t>(OpCode::NoReturn) + 1;
+    if (proto.code.empty()) invalid();
+    const OpCode last = opcodeOf(proto.code.back());
+    if (last != OpCode::Return && last != OpCode::NoReturn) invalid();
+    for (const Instruction word : proto.code) {
+      if ((word & 0xFF) >= OpCodeCount) invalid();
+      const uint32_t operand = operandOf(word);
+      bool valid = true;
+      switch (opcodeOf(word)) {
+        case OpCode::Constant: valid = operand < m_module.constants.size(); break;
+        case OpCode::LoadLocal: case OpCode::StoreLocal: case OpCode::NewBox: case OpCode::LoadBoxed: case OpCode::StoreBoxed:
+          valid = operand < proto.frameSize;
+          break;
+        case OpCode::LoadGlobal: case OpCode::StoreGlobal: valid = operand < m_module.globalCount; break;
+        case OpCode::LoadCapture: case OpCode::LoadCaptureBoxed: case OpCode::StoreCaptureBoxed:
+          valid = operand < proto.captureCount;
+          break;
+        case OpCode::CheckType: valid = operand <= static_cast<uint32_t>(TypeKind::Void); break;
+        case OpCode::CoerceParam:
+          valid = (operand >> 8) < proto.frameSize && (operand & 0xFF) <= static_cast<uint32_t>(TypeKind::Void);
+          break;
+        case OpCode::New: case OpCode::CheckClass: valid = operand < m_module.classes.size(); break;
+        case OpCode::GetMember: case OpCode::SetMember: valid = operand < m_module.memberSites.size(); break;
+        case OpCode::Jump: case OpCode::JumpIfFalse: valid = operand < proto.code.size(); break;
+        case OpCode::Closure: case OpCode::CallDirect: valid = operand < m_module.functions.size(); break;
+        // 戻り値の変換はTypeKind+1（0は変換なし）
+        case OpCode::TailCall: valid = operand <= static_cast<uint32_t>(TypeKind::Void) + 1; break;
+        case OpCode::TailCallDirect:
+          valid = (operand >> 4) < m_module.functions.size() && (operand & 0xF) <= static_cast<uint32_t>(TypeKind::Void) + 1;
+          break;
+        default: break;
+      }
+      if (!valid) invalid();
+    }
+  }
+};
+
+// 書き込みは一時ファイルを経由し、途中で失敗しても書きかけのイメージを残さない
+inline void saveImage(const BytecodeModule& module, const std::filesystem::path& path) {
+  const std::string data = ImageWriter().write(module);
+  const std::filesystem::path temporary = path.string() + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out) throw std::runtime_error("Failed to write " + path.string());
+  }
+  std::filesystem::rename(temporary, path);
+}
+inline BytecodeModule loadImage(const std::string& path) {
+  const SourceFile file(path);
+  return ImageReader::read(file.view());
+}
@@ -0,0 +1,111 @@
+# pragma once
+# include <algorithm>
+# include <format>
+# include <iterator>
+# include <memory>
+# include <stdexcept>
+# include <string>
+# include <string_view>
+# include <unordered_set>
+# include <vector>
+
+# include "scan.hpp"
+# include "parser.hpp"
+
+// エディタ向けの差分構文解析
+// 編集位置の手前から解析し直し、編集範囲より後ろの変わっていない位置に文の先頭が揃った時点で
+// 残りのトップレベルの文は前回の木をそのまま使う
+// （Resolver以降のパスはノードを書き換えるので、引き継ぐ木には走らせない）
+class IncrementalParser {
+public:
+  explicit IncrementalParser(std::string source)
+    : m_source(std::move(source)), m_types(std::make_shared<TypeContext>()) {
+    reparse(0, 0, 0);
+  }
+  // [from, to) を text で置き換えて解析し直す（解析に失敗した場合は例外を投げ、次の編集で解析し直す）
+  std::shared_ptr<ProgramNode> edit(const size_t from, const size_t to, const std::string_view text) {
+    if (from > to || to > m_source.length()) throw std::runtime_error("Edit range out of bounds");
+    m_source.replace(from, to - from, text);
+    reparse(from, to, static_cast<ptrdiff_t>(text.length()) - static_cast<ptrdiff_t>(to - from));
+    return m_program;
+  }
+  std::shared_ptr<ProgramNode> program() const {
+    return m_program;
+  }
+  const std::string& source() const {
+    return m_source;
+  }
+  // 直前の解析で前回の木から引き継いだ文の数
+  size_t reused() const {
+    return m_reused;
+  }
+private:
+  // トップレベルの文と、そのソース上の範囲（endは次のトークンの先頭）
+  struct Statement {
+    size_t begin;
+    size_t end;
+    ASTNode* node;
+    std::shared_ptr<AstArena> arena;
+  };
+  std::string m_source;
+  std::shared_ptr<TypeContext> m_types;
+  std::vector<Statement> m_statements;
+  std::shared_ptr<ProgramNode> m_program;
+  size_t m_reused = 0;
+  // 前回の解析が末尾まで成功したか（失敗した場合、文の列は途中までしかない）
+  bool m_complete = false;
+
+  // [from, to) は編集前の位置、deltaは編集による長さの変化
+  void reparse(const size_t from, const size_t to, const ptrdiff_t delta) {
+    // 文の解析は直後のトークンを1つ先読みする（se文の後ろのalieなど）ので、
+    // 編集位置を含む文の1つ前の文から解析し直す
+    const auto first = std::ranges::upper_bound(m_statements, from, {}, &Statement::begin);
+    const size_t keep = std::max<ptrdiff_t>(first - m_statements.begin() - 2, 0);
+    // 編集範囲より後ろから始まる文は、位置をずらせばそのまま使える候補になる
+    std::vector<Statement> tail;
+    if (m_complete) {
+      const auto reusable = std::ranges::lower_bound(m_statements.begin() + keep, m_statements.end(), to, {}, &Statement::begin);
+      tail.assign(std::make_move_iterator(reusable), std::make_move_iterator(m_statements.end()));
+    }
+    m_statements.resize(keep);
+    m_complete = false;
+    m_reused = keep;
+    const size_t restart = keep > 0 ? m_statements.back().end : 0;
+    // 解析を始める位置の行と列
+    const scan::Newlines lines = scan::newlines(m_source.data(), restart);
+    const int line = static_cast<int>(lines.count) + 1;
+    const int column = static_cast<int>(lines.count > 0 ? restart - lines.last - 1 : restart);
+    Parser parser(std::string_view(m_source).substr(restart), m_types, line, column);
+    auto candidate = tail.begin();
+    while (!parser.atEnd()) {
+      const size_t begin = restart + parser.getCurrentOffset();
+      // 前回と同じ位置に文の先頭が来たら、それ以降のトークン列と文は前回と変わらない
+      while (candidate != tail.end() && static_cast<ptrdiff_t>(candidate->begin) + delta < static_cast<ptrdiff_t>(begin)) ++candidate;
+      if (candidate != tail.end() && static_cast<ptrdiff_t>(candidate->begin) + delta == static_cast<ptrdiff_t>(begin)) {
+        for (auto iter = candidate; iter != tail.end(); ++iter) {
+          m_statements.push_back({iter->begin + delta, iter->end + delta, iter->node, std::move(iter->arena)});
+        }
+        m_reused += tail.end() - candidate;
+        break;
+      }
+      ASTNode* const node = parser.parseNext();
+      // 構文エラーは最初の1つを報告し、文の列はエラーを含む文の手前までにする（ブロック内で回復した文も含めない）
+      if (!parser.diagnostics().empty()) throw std::runtime_error(std::format("{}", parser.diagnostics().front()));
+      m_statements.push_back({begin, restart + parser.getCurrentOffset(), node, parser.getArena()});
+    }
+    m_complete = true;
+    m_program = std::make_shared<ProgramNode>();
+    m_program->arena = parser.getArena();
+    m_program->types = m_types;
+    m_program->statements.reserve(m_statements.size());
+    // 同じ解析で作られた文は並んでいるので、直前と違うアリーナのときだけ重複を調べる
+    std::unordered_set<const AstArena*> seen{m_program->arena.get()};
+    const AstArena* previous = m_program->arena.get();
+    for (const Statement& statement : m_statements) {
+      m_program->statements.push_back(statement.node);
+      if (statement.arena.get() == previous) continue;
+      previous = statement.arena.get();
+      if (seen.insert(previous).second) m_program->retained.push_back(statement.arena);
+    }
+  }
+};
@@ -0,0 +1,372 @@
+# pragma once
+# include <deque>
+# include <exception>
+# include <functional>
+# include <stdexcept>
+# include <unordered_map>
+
+# include <pthread.h>
+
+# include "ast.hpp"
+# include "value.hpp"
+
+// Resolver・TypeChecker済みのASTをそのまま実行する
+// GCは文の境目で行い、ルートは影のスタックm_rootsに積んだ範囲（トップレベルの変数、各呼び出しのローカル変数と
+// クロージャ、評価の途中でC++のローカル変数に持っている値）
+// オブジェクトが移動するので、文を実行する間はオブジェクトへのポインタや参照ではなくルートにしたValueを持つ
+class Interpreter {
+public:
+  // プログラムを実行してグローバル変数のフレームを返す
+  std::shared_ptr<Frame> run(const ProgramNode& program) {
+    const auto globals = std::make_shared<Frame>(program.frameSize);
+    m_globals = globals->slots;
+    m_roots.assign({m_globals, std::span(&m_returnValue, 1), std::span(&m_tailCallee, 1)});
+    onLargeStack([&] {
+      const Env env{nullptr, nullptr};
+      for (const ASTNode* stmt : program.statements) {
+        safepoint();
+        if (execute(stmt, env) != Flow::Next) break;
+      }
+    });
+    return globals;
+  }
+private:
+  // 呼び出しのたびにC++の関数を再帰するので、MaxCallDepthの深さまで届くスタックを持つスレッドで実行する
+  // （確保するのは仮想アドレスだけで、使った分だけメモリを使う）
+  static constexpr size_t StackSize = size_t{512} << 20;
+  // TailCallはm_tailCalleeをm_returnValueを引数に呼び出す末尾呼び出し（呼び出し元のcallが処理する）
+  // m_tailConvertはその戻り値に行う変換（なければnullptr）
+  enum class Flow { Next, Return, TailCall };
+  // 実行中の関数のローカル変数と呼び出されたクロージャ
+  struct Env {
+    Value* locals;
+    const Value* self;
+  };
+  Value m_returnValue;
+  Value m_tailCallee;
+  const Type* m_tailConvert = nullptr;
+  Heap& m_heap = heap();
+  std::span<Value> m_globals;
+  // 宣言済みのklaso（インスタンスが指すので要素の移動しないdequeに置く）
+  std::deque<ClassInfo> m_classes;
+  std::unordered_map<const Type*, const ClassInfo*> m_classInfo;
+  // callの再帰の深さ（末尾呼び出しは深くならない）
+  size_t m_depth = 0;
+  // GCのルート（Rootがスコープの間だけ積む）
+  std::vector<std::span<Value>> m_roots;
+
+  // スコープの間だけ値をGCのルートにする（移動したオブジェクトを指すよう書き換えられる）
+  class Root {
+  public:
+    Root(Interpreter& interpreter, const std::span<Value> values)
+      : m_roots(interpreter.m_roots) {
+      m_roots.push_back(values);
+    }
+    Root(Interpreter& interpreter, Value& value)
+      : Root(interpreter, std::span(&value, 1)) {}
+    Root(const Root&) = delete;
+    Root& operator=(const Root&) = delete;
+    ~Root() {
+      m_roots.pop_back();
+    }
+  private:
+    std::vector<std::span<Value>>& m_roots;
+  };
+  // 評価しても文を実行しない（GCが起きない）式
+  static bool leaf(const ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::NumberLiteral: case NodeKind::StringLiteral: case NodeKind::BoolLiteral: case NodeKind::VarRef:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // fをStackSizeのスタックを持つスレッドで実行し、終わるまで待つ（例外は呼び出し元へ投げ直す）
+  // スレッドを作れなければこのスレッドで実行する
+  static void onLargeStack(const std::function<void()>& f) {
+    struct Task {
+      const std::function<void()>& f;
+      std::exception_ptr error;
+    } task{f, nullptr};
+    const auto entry = [](void* arg) -> void* {
+      auto* const task = static_cast<Task*>(arg);
+      try {
+        task->f();
+      } catch (...) {
+        task->error = std::current_exception();
+      }
+      return nullptr;
+    };
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0) return f();
+    pthread_t thread;
+    const bool created = pthread_attr_setstacksize(&attr, StackSize) == 0 && pthread_create(&thread, &attr, entry, &task) == 0;
+    pthread_attr_destroy(&attr);
+    if (!created) return f();
+    pthread_join(thread, nullptr);
+    if (task.error) std::rethrow_exception(task.error);
+  }
+
+  void safepoint() {
+    if (m_heap.collectRequested()) m_heap.collect(m_roots);
+  }
+  static Closure* closureOf(const Env& env) {
+    return &env.self->asClosure();
+  }
+  // 変数の領域（箱に入れた変数なら箱そのもの）
+  Value& storage(const Slot slot, const Env& env) const {
+    switch (slot.storage) {
+      case Storage::Local: return env.locals[slot.index];
+      case Storage::Global: return m_globals[slot.index];
+      case Storage::Capture: return closureOf(env)->captures()[slot.index];
+      case Storage::Self: break;
+    }
+    throw std::runtime_error("Cannot assign to funkcio");
+  }
+  Value load(const Slot slot, const Env& env) const {
+    if (slot.storage == Storage::Self) return *env.self;
+    Value& value = storage(slot, env);
+    return slot.boxed ? unbox(value) : value;
+  }
+  void store(const Slot slot, const Env& env, const Value& value) const {
+    Value& target = storage(slot, env);
+    if (slot.boxed) storeBoxed(target, value);
+    else target = value;
+  }
+  // 宣言（箱に入れる変数は宣言のたびに新しい箱を作る）
+  void declare(const Slot slot, const Env& env, const Value& value) const {
+    storage(slot, env) = slot.boxed ? box(value) : value;
+  }
+  // 捕捉する値をコピーしてクロージャを作る（箱はそのまま共有する）
+  Value makeClosure(const ASTNode* function, const ArenaVector<Slot>& captures, const Env& env) const {
+    Value closure = Closure::make(function, nullptr, static_cast<uint32_t>(captures.size()));
+    for (size_t i = 0; i < captures.size(); ++i) {
+      const Slot source = captures[i];
+      closure.asClosure().captures()[i] = source.storage == Storage::Self ? *env.self : storage(source, env);
+    }
+    return closure;
+  }
+  static Value defaultValue(const Type* type) {
+    switch (type->kind) {
+      case TypeKind::Entjera: return int64_t{0};
+      case TypeKind::Reala: return 0.0;
+      case TypeKind::Teksta: return std::string();
+      case TypeKind::Bulea: return false;
+      default: return Value();
+    }
+  }
+  // klaso型の変数を宣言だけしたときは新しいインスタンスを作る（フィールドは初期化式か既定値）
+  // 初期化式の途中のGCで旧世代へ移ることがあるので、フィールドへは書き込みバリアを通して入れる
+  Value newInstance(const Type* type, const Env& env) {
+    const ClassInfo* klass = m_classInfo.at(type);
+    Value instance = Instance::make(klass);
+    const Root root(*this, instance);
+    for (uint32_t i = 0; i < klass->fieldCount; ++i) {
+      const VarDeclNode* field = klass->decl->fields[i];
+      const Value value = field->initializer ? evaluate(field->initializer, env) : defaultValue(field->type);
+      storeField(instance.asInstance(), i, value);
+    }
+    return instance;
+  }
+  static int32_t memberIndex(const Instance& instance, const SymbolId member) {
+    const int32_t index = instance.klass->find(member);
+    if (index < 0) unknownMember(*instance.klass, member);
+    return index;
+  }
+  static bool condition(const Value& value) {
+    if (value.isBool()) return value.asBool();
+    throw std::runtime_error("Condition must be bulea");
+  }
+
+  Flow executeBlock(const ArenaVector<ASTNode*>& body, const Env& env) {
+    for (const ASTNode* stmt : body) {
+      safepoint();
+      const Flow flow = execute(stmt, env);
+      if (flow != Flow::Next) return flow;
+    }
+    return Flow::Next;
+  }
+  Flow execute(const ASTNode* node, const Env& env) {
+    switch (node->kind) {
+      case NodeKind::VarDecl: {
+        const auto* decl = static_cast<const VarDeclNode*>(node);
+        if (decl->initializer) declare(decl->slot, env, evaluate(decl->initializer, env));
+        else declare(decl->slot, env, decl->type->kind == TypeKind::Klaso ? newInstance(decl->type, env) : defaultValue(decl->type));
+        return Flow::Next;
+      }
+      case NodeKind::Assign: {
+        const auto* assign = static_cast<const AssignNode*>(node);
+        store(assign->slot, env, evaluate(assign->value, env));
+        return Flow::Next;
+      }
+      case NodeKind::MemberAssign: {
+        const auto* assign = static_cast<const MemberAssignNode*>(node);
+        Value object = evaluate(assign->object, env);
+        const Root root(*this, object);
+        Value value = evaluate(assign->value, env);
+        Instance& instance = instanceOf(object);
+        const int32_t index = memberIndex(instance, assign->member);
+        if (static_cast<uint32_t>(index) >= instance.fieldCount) {
+          throw std::runtime_error("Cannot assign to method " + std::string(symbolTable().name(assign->member)));
+        }
+        coerce(value, instance.klass->fieldTypes[index]);
+        storeField(instance, index, value);
+        return Flow::Next;
+      }
+      case NodeKind::FunctionDecl: {
+        const auto* func = static_cast<const FunctionDeclNode*>(node);
+        declare(func->slot, env, makeClosure(func, func->captures, env));
+        return Flow::Next;
+      }
+      case NodeKind::Return: {
+        const ExprNode* value = static_cast<const ReturnNode*>(node)->value;
+        // 関数の中で呼び出しの結果を返すならC++の再帰をせずに呼び出し元で呼ぶ
+        const auto* convert = nodeCast<ConvertNode>(value);
+        const ExprNode* returned = convert ? convert->operand : value;
+        if (returned->kind == NodeKind::Call && env.self) {
+          const auto* call = static_cast<const CallNode*>(returned);
+          // 引数の評価の中の末尾呼び出しもm_tailCalleeを使うので、両方を評価してから設定する
+          Value callee = evaluate(call->function, env);
+          const Root root(*this, callee);
+          const Value argument = evaluate(call->argument, env);
+          m_tailCallee = callee;
+          m_returnValue = argument;
+          m_tailConvert = convert ? convert->type : nullptr;
+          return Flow::TailCall;
+        }
+        m_returnValue = evaluate(value, env);
+        return Flow::Return;
+      }
+      case NodeKind::If: {
+        const auto* ifNode = static_cast<const IfNode*>(node);
+        return condition(evaluate(ifNode->condition, env))
+          ? executeBlock(ifNode->thenBody, env)
+          : executeBlock(ifNode->elseBody, env);
+      }
+      case NodeKind::While: {
+        const auto* whileNode = static_cast<const WhileNode*>(node);
+        while (condition(evaluate(whileNode->condition, env))) {
+          const Flow flow = executeBlock(whileNode->body, env);
+          if (flow != Flow::Next) return flow;
+        }
+        return Flow::Next;
+      }
+      case NodeKind::Block:
+        return executeBlock(static_cast<const BlockNode*>(node)->body, env);
+      case NodeKind::ClassDecl: {
+        const auto* classDecl = static_cast<const ClassDeclNode*>(node);
+        m_classInfo[classDecl->type] = &m_classes.emplace_back(classDecl);
+        return Flow::Next;
+      }
+      default:
+        evaluate(static_cast<const ExprNode*>(node), env);
+        return Flow::Next;
+    }
+  }
+
+  Value evaluate(const ExprNode* node, const Env& env) {
+    switch (node->kind) {
+      case NodeKind::NumberLiteral: {
+        const auto* number = static_cast<const NumberLiteral*>(node);
+        if (number->isInteger) return number->integer;
+        return number->real;
+      }
+      case NodeKind::StringLiteral:
+        return static_cast<const StringLiteral*>(node)->value;
+      case NodeKind::BoolLiteral:
+        return static_cast<const BoolLiteral*>(node)->value;
+      case NodeKind::VarRef:
+        return load(static_cast<const VarRefNode*>(node)->slot, env);
+      case NodeKind::BinaryOp: {
+        const auto* binary = static_cast<const BinaryOpNode*>(node);
+        // 左辺から順に評価する（右辺で関数を呼ぶなら左辺の値をルートにする）
+        Value left = evaluate(binary->left, env);
+        if (leaf(binary->right)) return binaryOp(binary->op, left, evaluate(binary->right, env));
+        const Root root(*this, left);
+        const Value right = evaluate(binary->right, env);
+        return binaryOp(binary->op, left, right);
+      }
+      case NodeKind::Call: {
+        const auto* call = static_cast<const CallNode*>(node);
+        Value callee = evaluate(call->function, env);
+        if (leaf(call->argument)) return this->call(callee, evaluate(call->argument, env));
+        const Root root(*this, callee);
+        const Value argument = evaluate(call->argument, env);
+        return this->call(callee, argument);
+      }
+      case NodeKind::AtFunction:
+        return makeClosure(node, static_cast<const AtFunctionNode*>(node)->captures, env);
+      case NodeKind::Convert: {
+        const auto* convert = static_cast<const ConvertNode*>(node);
+        Value value = evaluate(convert->operand, env);
+        coerce(value, convert->type);
+        return value;
+      }
+      case NodeKind::MemberAccess: {
+        const auto* member = static_cast<const MemberAccessNode*>(node);
+        Value object = evaluate(member->object, env);
+        Instance& instance = instanceOf(object);
+        const int32_t index = memberIndex(instance, member->member);
+        if (static_cast<uint32_t>(index) < instance.fieldCount) return instance.fields()[index];
+        const FunctionDeclNode* method = instance.klass->decl->methods[index - instance.fieldCount];
+        return bindMethod(method, nullptr, static_cast<uint32_t>(method->captures.size()), object);
+      }
+      default:
+        throw std::runtime_error("Unknown expression");
+    }
+  }
+
+  // 末尾呼び出しは同じループで次の関数を呼び、戻り値の変換は最後に内側のものから行う
+  Value call(Value callee, Value argument) {
+    if (m_depth >= MaxCallDepth) throw std::runtime_error("Stack overflow");
+    ++m_depth;
+    struct Leave {
+      size_t& depth;
+      ~Leave() { --depth; }
+    } leave{m_depth};
+    std::vector<const Type*> converts;
+    for (;;) {
+      if (!callee.isClosure()) throw std::runtime_error("Called value is not a funkcia");
+      const ASTNode* function = callee.asClosure().function;
+      const ArenaVector<ASTNode*>* body;
+      const Type* paramType;
+      uint32_t frameSize;
+      bool paramBoxed;
+      if (function->kind == NodeKind::FunctionDecl) {
+        const auto* func = static_cast<const FunctionDeclNode*>(function);
+        body = &func->body;
+        paramType = func->paramType;
+        frameSize = func->frameSize;
+        paramBoxed = func->paramBoxed;
+      } else {
+        const auto* atFunc = static_cast<const AtFunctionNode*>(function);
+        body = &atFunc->body;
+        paramType = atFunc->paramType;
+        frameSize = atFunc->frameSize;
+        paramBoxed = atFunc->paramBoxed;
+      }
+      // VMと同じくローカル変数の直前に呼び出されたクロージャを置き、まとめてルートにする
+      std::vector<Value> frame(frameSize + 1);
+      const Root root(*this, frame);
+      frame[0] = callee;
+      Value* const locals = frame.data() + 1;
+      // 静的に型の分からない呼び出しもあるので引数を宣言された型へ合わせる
+      coerce(argument, paramType);
+      locals[0] = paramBoxed ? box(argument) : argument;
+      switch (executeBlock(*body, Env{locals, frame.data()})) {
+        case Flow::Return:
+          for (auto type = converts.rbegin(); type != converts.rend(); ++type) coerce(m_returnValue, *type);
+          return std::move(m_returnValue);
+        case Flow::TailCall:
+          // 続けて同じ変換をしても結果は変わらないので重ねない
+          if (m_tailConvert && (converts.empty() || converts.back() != m_tailConvert)) converts.push_back(m_tailConvert);
+          callee = std::move(m_tailCallee);
+          argument = std::move(m_returnValue);
+          break;
+        case Flow::Next:
+          throw std::runtime_error("Function ended without reveni");
+      }
+    }
+  }
+};
@@ -0,0 +1,126 @@
+# pragma once
+# include <unordered_map>
+# include <unordered_set>
+# include <vector>
+
+# include "ast.hpp"
+# include "diagnostic.hpp"
+# include "parser.hpp"
+
+// 遅延解析したfunkcioの本体のうち、使われうるものだけを解析する
+// 解析済みのコードから名前で参照されているfunkcio（メソッドはメンバー名で参照されているもの）の本体を解析し、
+// そこから新たに参照された名前についても繰り返す
+// 参照は名前だけで判断するので、同じ名前の別の変数への参照でも解析する側に倒れ、呼ばれうる本体は必ず解析される
+// 一度も参照されないfunkcioは本体が空のまま後続のパスへ渡る（呼ばれることがないので実行結果は変わらない）
+class LazyLoader : public ASTVisitor<LazyLoader> {
+public:
+  // Resolverより前に呼ぶ（本体の構文エラーを返す）
+  std::vector<Diagnostic> load(ProgramNode& program) {
+    std::vector<Diagnostic> diagnostics;
+    for (ASTNode* stmt : program.statements) m_stack.push_back(stmt);
+    walk();
+    while (!m_ready.empty()) {
+      FunctionDeclNode* const func = m_ready.back();
+      m_ready.pop_back();
+      Parser::parseBody(program, *func, diagnostics);
+      ++m_parsed;
+      for (ASTNode* stmt : func->body) m_stack.push_back(stmt);
+      walk();
+    }
+    return diagnostics;
+  }
+  // 解析した本体と、参照されずに残った本体の数
+  size_t parsed() const {
+    return m_parsed;
+  }
+  size_t skipped() const {
+    return m_pending.size();
+  }
+
+  void visitVarRef(VarRefNode& node) {
+    reference(node.name);
+  }
+  void visitBinaryOp(BinaryOpNode& node) {
+    push(node.left);
+    push(node.right);
+  }
+  void visitCall(CallNode& node) {
+    push(node.function);
+    push(node.argument);
+  }
+  void visitAtFunction(AtFunctionNode& node) {
+    for (ASTNode* stmt : node.body) push(stmt);
+  }
+  void visitMemberAccess(MemberAccessNode& node) {
+    reference(node.member);
+    push(node.object);
+  }
+  void visitConvert(ConvertNode& node) {
+    push(node.operand);
+  }
+  void visitVarDecl(VarDeclNode& node) {
+    push(node.initializer);
+  }
+  void visitAssign(AssignNode& node) {
+    push(node.value);
+  }
+  void visitMemberAssign(MemberAssignNode& node) {
+    push(node.object);
+    push(node.value);
+  }
+  void visitFunctionDecl(FunctionDeclNode& node) {
+    if (node.pendingBody.empty()) {
+      for (ASTNode* stmt : node.body) push(stmt);
+    } else if (m_referenced.contains(node.name)) {
+      m_ready.push_back(&node);
+    } else {
+      m_pending.emplace(node.name, &node);
+    }
+  }
+  void visitReturn(ReturnNode& node) {
+    push(node.value);
+  }
+  void visitIf(IfNode& node) {
+    push(node.condition);
+    for (ASTNode* stmt : node.thenBody) push(stmt);
+    for (ASTNode* stmt : node.elseBody) push(stmt);
+  }
+  void visitWhile(WhileNode& node) {
+    push(node.condition);
+    for (ASTNode* stmt : node.body) push(stmt);
+  }
+  void visitBlock(BlockNode& node) {
+    for (ASTNode* stmt : node.body) push(stmt);
+  }
+  void visitClassDecl(ClassDeclNode& node) {
+    for (VarDeclNode* field : node.fields) push(field);
+    for (FunctionDeclNode* method : node.methods) push(method);
+  }
+private:
+  // 明示的なスタックで辿るので深い木でも再帰しない
+  std::vector<ASTNode*> m_stack;
+  std::unordered_set<SymbolId> m_referenced;
+  // 名前がまだ参照されていない、本体を解析していないfunkcio
+  std::unordered_multimap<SymbolId, FunctionDeclNode*> m_pending;
+  // 本体を解析するfunkcio
+  std::vector<FunctionDeclNode*> m_ready;
+  size_t m_parsed = 0;
+
+  void push(ASTNode* node) {
+    if (node) m_stack.push_back(node);
+  }
+  void walk() {
+    while (!m_stack.empty()) {
+      ASTNode* const node = m_stack.back();
+      m_stack.pop_back();
+      visit(*node);
+    }
+  }
+  // 初めて参照された名前のfunkcioを解析待ちへ移す
+  void reference(const SymbolId name) {
+    if (!m_referenced.insert(name).second) return;
+    const auto [begin, end] = m_pending.equal_range(name);
+    for (auto iter = begin; iter != end; ++iter) m_ready.push_back(iter->second);
+    m_pending.erase(begin, end);
+  }
+};
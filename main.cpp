@@ -1,27 +1,103 @@
 # include <iostream>
-# include <fstream>
 
+// --profileで確保を数えるためにoperator newを置き換える（数えるのは--profileのときだけ）
+# define ESPERO_COUNT_ALLOCATIONS
+# include "profile.hpp"
+
+# include "source.hpp"
 # include "parser.hpp"
+# include "driver.hpp"
+# include "chunked.hpp"
+# include "resolver.hpp"
+# include "typechecker.hpp"
+# include "optimizer.hpp"
+# include "interpreter.hpp"
+# include "compiler.hpp"
+# include "vm.hpp"
+# include "image.hpp"
+# include "lazy.hpp"
+
+// 複数ファイルをまとめて構文解析し、ファイルごとの結果を入力順に表示する
+int parseAll(const std::vector<std::string>& inputs, const size_t jobs, const std::string& cache) {
+  Driver driver(jobs);
+  if (!cache.empty()) driver.useCache(cache);
+  const std::vector<ParsedFile> results = driver.parse(Driver::collect(inputs));
+  int status = 0;
+  for (const ParsedFile& result : results) {
+    if (!result.program) {
+      std::cerr << result.diagnostic << std::endl;
+      status = 1;
+      continue;
+    }
+    std::cout << std::format("{}: {} statements{}", result.path, result.program->statements.size(), result.cached ? " (cached)" : "") << std::endl;
+  }
+  return status;
+}
+
+// --profileの結果を標準エラーへ表示する（VMで実行していればその実行回数も）
+void printProfile(const Profiler& profiler, const BytecodeModule* module, const VMProfile& vmProfile) {
+  std::cerr << std::endl << profiler.report();
+  const Heap::Stats& stats = heap().stats();
+  std::cerr << std::format("heap: {} bytes allocated, {} minor / {} major collections, {} bytes promoted, {} bytes freed",
+    heap().allocated(), stats.minor, stats.major, stats.promoted, stats.freed) << std::endl;
+  if (module) std::cerr << vmProfile.report(*module);
+}
+
+// コンパイル済みのイメージを読み込んで実行し、トップレベルの変数を表示する
+int runImage(const std::string& path, const bool profile) {
+  Profiler profiler;
+  VMProfile vmProfile;
+  try {
+    const BytecodeModule module = profiler.measure("load", [&] { return loadImage(path); });
+    VM vm(module);
+    if (profile) vm.setProfile(&vmProfile);
+    const std::shared_ptr<Frame> globals = profiler.measure("execute", [&] { return vm.run(); });
+    for (const GlobalName& global : module.globals) {
+      std::cout << std::format("{} = {}", symbolTable().name(global.name), globals->slots[global.slot]) << std::endl;
+    }
+    if (profile) printProfile(profiler, &module, vmProfile);
+  } catch (const std::exception& err) {
+    std::cerr << "Runtime error: " << err.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
 int main(int argc, char* argv[]) {
-  // ファイル名取得
-  // if (!argc == 2) throw std::runtime_error("<input file>");
-  // std::string fileName = argv[1];
-  std::string fileName = "./test.txt";
-  // ファイルオープン
-  std::ifstream file;
-  file.open(fileName);
-  if (!file.is_open()) throw std::runtime_error("Failed to open a " + fileName);
-  // ファイル読み込み
-  std::string content;
-  file.seekg(0, std::ios::end);
-  content.reserve(file.tellg());
-  file.seekg(0, std::ios::beg);
-  // イテレータで読みこむ
-  content.assign(
-    (std::istreambuf_iterator<char>(file)),
-    std::istreambuf_iterator<char>()
-  );
+  // 引数取得（ファイル名の"-"は標準入力、--interpretでASTを直接実行、--jobs/-jで並列数を指定、--cacheで複数ファイルの構文解析結果をキャッシュ、
+  // --emitでコンパイル結果を.esperocイメージへ保存し、.esperocのファイルはそのまま実行、--lazyで使われるfunkcioの本体だけを解析、
+  // --profileでフェーズごとの時間と確保、VMの関数ごとの呼び出し回数とループの周回数を標準エラーへ表示）
+  std::vector<std::string> inputs;
+  bool interpret = false;
+  bool lazy = false;
+  bool profile = false;
+  size_t jobs = std::thread::hardware_concurrency();
+  std::string cache;
+  std::string emit;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--interpret") interpret = true;
+    else if (arg == "--lazy") lazy = true;
+    else if (arg == "--profile") profile = true;
+    else if ((arg == "--jobs" || arg == "-j") && i + 1 < argc) jobs = std::stoul(argv[++i]);
+    else if (arg == "--cache" && i + 1 < argc) cache = argv[++i];
+    else if (arg == "--emit" && i + 1 < argc) emit = argv[++i];
+    else inputs.emplace_back(arg);
+  }
+  if (inputs.empty()) inputs.emplace_back("./test.txt");
+  AllocationCounter::enabled = profile;
+  // 複数のファイルやディレクトリは構文解析までを並列に行う
+  if (inputs.size() > 1 || std::filesystem::is_directory(inputs.front())) {
+    return parseAll(inputs, jobs, cache);
+  }
+  const std::string& fileName = inputs.front();
+  if (std::filesystem::path(fileName).extension() == ".esperoc") return runImage(fileName, profile);
+  // 表示は計測に含めない
+  Profiler profiler;
+  // ファイル読み込み（mmapした内容をそのままトークナイザに渡す）
+  const SourceFile source = profiler.measure("load", [&] { return SourceFile(fileName); });
+  const std::string_view content = source.view();
+  profiler.items(content.length(), "bytes");
   // ファイル表示
   std::cout << content << std::endl;
 
@@ -29,24 +105,73 @@ int main(int argc, char* argv[]) {
   for(int i = 0; i < 64; ++i) std::cout << '-';
   std::cout << std::endl << std::endl;
 
+  // 大きなファイルはチャンクに分けて並列にトークン化し、その列をそのまま構文解析する
+  const bool chunked = jobs > 1 && content.length() >= 2 * ChunkedTokenizer::MinChunkSize;
   Tokenizer tokenizer(content);
-  const std::vector<Token> tokens = tokenizer.tokenize();
-  for (const Token& token : tokens) {
-    std::cout << std::format("{}", token) << std::endl;
+  ChunkedTokenizer chunkedTokenizer(content);
+  TokenBuffer tokens = profiler.measure("tokenize", [&] { return chunked ? chunkedTokenizer.tokenize(jobs) : tokenizer.buffer(); });
+  profiler.items(tokens.size(), "tokens");
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    std::cout << std::format("{}", tokens.token(i)) << std::endl;
   }
 
   std::cout << std::endl;
   for(int i = 0; i < 64; ++i) std::cout << '-';
   std::cout << std::endl << std::endl;
 
-  Parser parser(tokens);
+  // 構文エラーはまとめて表示する
+  Parser parser(std::move(tokens));
+  parser.setLazyBodies(lazy);
+  const std::shared_ptr<ProgramNode> program = profiler.measure("parse", [&] { return parser.parse(); });
+  profiler.items(program->arena->objectCount(), "nodes");
+  std::vector<Diagnostic> diagnostics = parser.diagnostics();
+  if (lazy && diagnostics.empty()) {
+    const size_t parsed = program->arena->objectCount();
+    diagnostics = profiler.measure("lazy", [&] { return LazyLoader().load(*program); });
+    profiler.items(program->arena->objectCount() - parsed, "nodes");
+  }
+  if (!diagnostics.empty()) {
+    for (const Diagnostic& diagnostic : diagnostics) {
+      std::cerr << std::format("{}:{}", fileName, diagnostic) << std::endl;
+    }
+    return 1;
+  }
+  dump(*program, std::ostreambuf_iterator<char>(std::cout));
+  std::cout << std::endl << std::endl;
+
+  for(int i = 0; i < 64; ++i) std::cout << '-';
+  std::cout << std::endl << std::endl;
+
+  // 実行してグローバル変数を表示
   try {
-    auto program = parser.parse();
-    std::cout << program->toString() << std::endl << std::endl;
+    profiler.measure("resolve", [&] { Resolver().resolve(*program); });
+    profiler.measure("typecheck", [&] { TypeChecker().check(*program); });
+    profiler.measure("optimize", [&] { Optimizer().optimize(*program); });
+    // klasoのインスタンスが指す実行時の情報はグローバル変数より長く保つ
+    Interpreter interpreter;
+    BytecodeModule module;
+    VMProfile vmProfile;
+    std::shared_ptr<Frame> globals;
+    if (interpret) {
+      globals = profiler.measure("execute", [&] { return interpreter.run(*program); });
+    } else {
+      module = profiler.measure("compile", [&] { return Compiler().compile(*program); });
+      if (!emit.empty()) saveImage(module, emit);
+      std::cout << disassemble(module) << std::endl;
+      for(int i = 0; i < 64; ++i) std::cout << '-';
+      std::cout << std::endl << std::endl;
+      VM vm(module);
+      if (profile) vm.setProfile(&vmProfile);
+      globals = profiler.measure("execute", [&] { return vm.run(); });
+    }
+    for (const ASTNode* stmt : program->statements) {
+      if (stmt->kind != NodeKind::VarDecl) continue;
+      const auto* decl = static_cast<const VarDeclNode*>(stmt);
+      std::cout << std::format("{} = {}", symbolTable().name(decl->name), globals->slots[decl->slot.index]) << std::endl;
+    }
+    if (profile) printProfile(profiler, interpret ? nullptr : &module, vmProfile);
   } catch (const std::exception& err) {
-    std::cerr << "Parse error: " << err.what() << std::endl;
-    std::cerr << parser.getCurrentPosition() << std::endl;
-    std::cerr << std::format("{}", parser.getCurrentToken()) << std::endl;
+    std::cerr << "Runtime error: " << err.what() << std::endl;
     return 1;
   }
 
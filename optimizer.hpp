@@ -0,0 +1,227 @@
+# pragma once
+# include <cstdint>
+# include <string>
+# include <vector>
+
+# include "ast.hpp"
+# include "value.hpp"
+
+// TypeChecker済みのASTを簡約する
+// リテラルだけの演算を畳み込み、条件が定数のifとdum (malvero)を取り除く
+// 整数のオーバーフローは実行時と同じく折り返して畳み込み、実行時にエラーになる0除算だけは畳み込まずに残す
+class Optimizer {
+public:
+  void optimize(ProgramNode& program) {
+    m_arena = program.arena.get();
+    size_t out = 0;
+    for (ASTNode* stmt : program.statements) {
+      if (ASTNode* result = optimizeStatement(stmt)) program.statements[out++] = result;
+    }
+    program.statements.resize(out);
+  }
+private:
+  using OpType = BinaryOpNode::OpType;
+  AstArena* m_arena = nullptr;
+
+  template<typename T, typename... Args>
+  T* make(const Type* type, Args&&... args) {
+    T* node = m_arena->make<T>(std::forward<Args>(args)...);
+    node->type = type;
+    return node;
+  }
+  ExprNode* integer(const int64_t value) {
+    return make<NumberLiteral>(TypeContext::primitive(TypeKind::Entjera), value);
+  }
+  ExprNode* real(const double value) {
+    return make<NumberLiteral>(TypeContext::primitive(TypeKind::Reala), value);
+  }
+  ExprNode* boolean(const bool value) {
+    return make<BoolLiteral>(TypeContext::primitive(TypeKind::Bulea), value);
+  }
+  // 条件が定数ならその値を返す
+  static const BoolLiteral* constantCondition(const ExprNode* node) {
+    return nodeCast<BoolLiteral>(node);
+  }
+
+  void optimizeBlock(ArenaVector<ASTNode*>& body) {
+    size_t out = 0;
+    for (ASTNode* stmt : body) {
+      if (ASTNode* result = optimizeStatement(stmt)) body[out++] = result;
+    }
+    body.truncate(out);
+  }
+  // 文を簡約する（消せる文ならnullptrを返す）
+  ASTNode* optimizeStatement(ASTNode* node) {
+    switch (node->kind) {
+      case NodeKind::VarDecl: {
+        auto* decl = static_cast<VarDeclNode*>(node);
+        if (decl->initializer) decl->initializer = optimizeExpression(decl->initializer);
+        return node;
+      }
+      case NodeKind::Assign: {
+        auto* assign = static_cast<AssignNode*>(node);
+        assign->value = optimizeExpression(assign->value);
+        return node;
+      }
+      case NodeKind::MemberAssign: {
+        auto* assign = static_cast<MemberAssignNode*>(node);
+        assign->object = optimizeExpression(assign->object);
+        assign->value = optimizeExpression(assign->value);
+        return node;
+      }
+      case NodeKind::FunctionDecl:
+        optimizeBlock(static_cast<FunctionDeclNode*>(node)->body);
+        return node;
+      case NodeKind::Return: {
+        auto* ret = static_cast<ReturnNode*>(node);
+        ret->value = optimizeExpression(ret->value);
+        return node;
+      }
+      case NodeKind::If: {
+        auto* ifNode = static_cast<IfNode*>(node);
+        ifNode->condition = optimizeExpression(ifNode->condition);
+        optimizeBlock(ifNode->thenBody);
+        optimizeBlock(ifNode->elseBody);
+        const BoolLiteral* condition = constantCondition(ifNode->condition);
+        if (!condition) return node;
+        // 通る枝だけをブロックとして残す（変数のスロットはResolverが割り当て済み）
+        ArenaVector<ASTNode*>& taken = condition->value ? ifNode->thenBody : ifNode->elseBody;
+        if (taken.empty()) return nullptr;
+        auto* block = m_arena->make<BlockNode>(*m_arena);
+        block->body = taken;
+        return block;
+      }
+      case NodeKind::While: {
+        auto* whileNode = static_cast<WhileNode*>(node);
+        whileNode->condition = optimizeExpression(whileNode->condition);
+        const BoolLiteral* condition = constantCondition(whileNode->condition);
+        if (condition && !condition->value) return nullptr;
+        optimizeBlock(whileNode->body);
+        return node;
+      }
+      case NodeKind::Block: {
+        auto* block = static_cast<BlockNode*>(node);
+        optimizeBlock(block->body);
+        return block->body.empty() ? nullptr : node;
+      }
+      case NodeKind::ClassDecl: {
+        auto* classDecl = static_cast<ClassDeclNode*>(node);
+        for (VarDeclNode* field : classDecl->fields) {
+          if (field->initializer) field->initializer = optimizeExpression(field->initializer);
+        }
+        for (FunctionDeclNode* method : classDecl->methods) optimizeBlock(method->body);
+        return node;
+      }
+      default: {
+        // 値を捨てるだけのリテラルは消す
+        ExprNode* expr = optimizeExpression(static_cast<ExprNode*>(node));
+        const bool literal = expr->kind == NodeKind::NumberLiteral
+          || expr->kind == NodeKind::StringLiteral || expr->kind == NodeKind::BoolLiteral;
+        return literal ? nullptr : expr;
+      }
+    }
+  }
+
+  ExprNode* optimizeExpression(ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::BinaryOp: {
+        auto* binary = static_cast<BinaryOpNode*>(node);
+        binary->left = optimizeExpression(binary->left);
+        binary->right = optimizeExpression(binary->right);
+        ExprNode* folded = fold(binary);
+        return folded ? folded : node;
+      }
+      case NodeKind::Call: {
+        auto* call = static_cast<CallNode*>(node);
+        call->function = optimizeExpression(call->function);
+        call->argument = optimizeExpression(call->argument);
+        return node;
+      }
+      case NodeKind::AtFunction:
+        optimizeBlock(static_cast<AtFunctionNode*>(node)->body);
+        return node;
+      case NodeKind::MemberAccess: {
+        auto* member = static_cast<MemberAccessNode*>(node);
+        member->object = optimizeExpression(member->object);
+        return node;
+      }
+      case NodeKind::Convert: {
+        auto* convert = static_cast<ConvertNode*>(node);
+        convert->operand = optimizeExpression(convert->operand);
+        // 整数リテラルの実数化
+        if (convert->type->kind == TypeKind::Reala && convert->operand->kind == NodeKind::NumberLiteral) {
+          const auto* number = static_cast<const NumberLiteral*>(convert->operand);
+          return number->isInteger ? real(static_cast<double>(number->integer)) : convert->operand;
+        }
+        return node;
+      }
+      default:
+        return node;
+    }
+  }
+
+  // 両辺がリテラルの二項演算を畳み込む（畳み込めなければnullptr）
+  ExprNode* fold(const BinaryOpNode* node) {
+    const NodeKind left = node->left->kind;
+    if (left != node->right->kind) return nullptr;
+    switch (left) {
+      case NodeKind::NumberLiteral: {
+        const auto* l = static_cast<const NumberLiteral*>(node->left);
+        const auto* r = static_cast<const NumberLiteral*>(node->right);
+        if (l->isInteger && r->isInteger) return foldInteger(node->op, l->integer, r->integer);
+        if (!l->isInteger && !r->isInteger) return foldReal(node->op, l->real, r->real);
+        return nullptr;
+      }
+      case NodeKind::StringLiteral: {
+        const std::string_view l = static_cast<const StringLiteral*>(node->left)->value;
+        const std::string_view r = static_cast<const StringLiteral*>(node->right)->value;
+        if (node->op == OpType::Add) {
+          return make<StringLiteral>(TypeContext::primitive(TypeKind::Teksta), m_arena->copy(std::string(l) + std::string(r)));
+        }
+        if (node->op == OpType::Eq) return boolean(l == r);
+        if (node->op == OpType::NEq) return boolean(l != r);
+        return nullptr;
+      }
+      case NodeKind::BoolLiteral: {
+        const bool l = static_cast<const BoolLiteral*>(node->left)->value;
+        const bool r = static_cast<const BoolLiteral*>(node->right)->value;
+        if (node->op == OpType::Eq) return boolean(l == r);
+        if (node->op == OpType::NEq) return boolean(l != r);
+        return nullptr;
+      }
+      default:
+        return nullptr;
+    }
+  }
+  // 実行時と同じく折り返して計算する
+  ExprNode* foldInteger(const OpType op, const int64_t l, const int64_t r) {
+    switch (op) {
+      case OpType::Add: return integer(addInt(l, r));
+      case OpType::Sub: return integer(subInt(l, r));
+      case OpType::Mul: return integer(mulInt(l, r));
+      case OpType::Div: return r == 0 ? nullptr : integer(divInt(l, r));
+      case OpType::Eq: return boolean(l == r);
+      case OpType::NEq: return boolean(l != r);
+      case OpType::LT: return boolean(l < r);
+      case OpType::GT: return boolean(l > r);
+      case OpType::LE: return boolean(l <= r);
+      case OpType::GE: return boolean(l >= r);
+    }
+    return nullptr;
+  }
+  ExprNode* foldReal(const OpType op, const double l, const double r) {
+    switch (op) {
+      case OpType::Add: return real(l + r);
+      case OpType::Sub: return real(l - r);
+      case OpType::Mul: return real(l * r);
+      case OpType::Div: return real(l / r);
+      case OpType::Eq: return boolean(l == r);
+      case OpType::NEq: return boolean(l != r);
+      case OpType::LT: return boolean(l < r);
+      case OpType::GT: return boolean(l > r);
+      case OpType::LE: return boolean(l <= r);
+      case OpType::GE: return boolean(l >= r);
+    }
+    return nullptr;
+  }
+};
@@ -1,142 +1,341 @@
 # pragma once
 # include "token.hpp"
 # include "ast.hpp"
+# include "diagnostic.hpp"
 # include <stdexcept>
 # include <stacktrace>
+# include <charconv>
+# include <array>
+
+namespace {
+  // 二項演算子の結合力と演算（powerが0なら二項演算子ではない）
+  struct BinaryOperator {
+    uint8_t power = 0;
+    BinaryOpNode::OpType op = BinaryOpNode::OpType::Add;
+  };
+  // TokenTypeの値で引く二項演算子の表（比較 < 加減 < 乗除の順に強く結合する）
+  constexpr auto BinaryOperators = [] {
+    using OpType = BinaryOpNode::OpType;
+    std::array<BinaryOperator, static_cast<size_t>(TokenType::Unknown) + 1> table{};
+    const auto set = [&table](const TokenType type, const uint8_t power, const OpType op) {
+      table[static_cast<size_t>(type)] = {power, op};
+    };
+    set(TokenType::Equal, 1, OpType::Eq);
+    set(TokenType::NotEqual, 1, OpType::NEq);
+    set(TokenType::Less, 1, OpType::LT);
+    set(TokenType::Greater, 1, OpType::GT);
+    set(TokenType::LessEqual, 1, OpType::LE);
+    set(TokenType::GreaterEqual, 1, OpType::GE);
+    set(TokenType::Plus, 2, OpType::Add);
+    set(TokenType::Minus, 2, OpType::Sub);
+    set(TokenType::Multiply, 3, OpType::Mul);
+    set(TokenType::Divide, 3, OpType::Div);
+    return table;
+  }();
+}
 
 class Parser {
 public:
-  Parser(const std::vector<Token>& tokens)
-    : m_tokens(tokens), m_position(0) {}
+  // トークン化済みの列を解析する
+  Parser(std::vector<Token> tokens)
+    : m_tokens(std::move(tokens)), m_arena(std::make_shared<AstArena>()), m_types(std::make_shared<TypeContext>()) {}
+  // TokenBufferの配列から解析する
+  Parser(TokenBuffer tokens)
+    : m_tokens(std::move(tokens)), m_arena(std::make_shared<AstArena>()), m_types(std::make_shared<TypeContext>()) {}
+  // ソースを逐次トークン化しながら解析する
+  Parser(std::string_view source)
+    : m_tokens(source), m_arena(std::make_shared<AstArena>()), m_types(std::make_shared<TypeContext>()) {}
+  // ソースの途中から切り出した区間を、既存の型（klasoの型など）を共有して解析する
+  Parser(std::string_view source, std::shared_ptr<TypeContext> types, const int line, const int column)
+    : m_tokens(source, line, column), m_arena(std::make_shared<AstArena>()), m_types(std::move(types)) {}
+  // 構文エラーがあっても最後まで読み、エラーはdiagnosticsに集める（エラーになった文は木に含めない）
   std::shared_ptr<ProgramNode> parse() {
     const auto program = std::make_shared<ProgramNode>();
-    while (current().type != TokenType::EndOfFile) {
-      program->statements.push_back(parseStatement());
+    program->arena = m_arena;
+    program->types = m_types;
+    while (!atEnd()) {
+      if (ASTNode* const stmt = parseNext()) program->statements.push_back(stmt);
     }
     return program;
   }
+  // トップレベルの文を1つずつ解析する（差分解析用）
+  bool atEnd() const {
+    return currentType() == TokenType::EndOfFile;
+  }
+  // エラーになった場合は次の文の先頭まで読み飛ばしてnullptrを返す
+  ASTNode* parseNext() {
+    const size_t start = m_tokens.position();
+    ASTNode* const stmt = parseStatement();
+    if (!stmt) synchronize(start);
+    return stmt;
+  }
+  // 見つかった構文エラー（ソース上の順）
+  const std::vector<Diagnostic>& diagnostics() const {
+    return m_diagnostics;
+  }
+  // funkcioの本体は波括弧の対応だけを調べて範囲を記録し、解析はparseBodyを呼ぶまで遅らせる
+  // （本体はソースを参照するので、ソースはparseBodyを呼び終えるまで保持する）
+  void setLazyBodies(const bool lazy) {
+    m_lazy = lazy;
+  }
+  // 遅延した本体を解析してfunc.bodyへ入れる（ノードはprogramのアリーナに置き、本体の中のfunkcioも遅延する）
+  static void parseBody(ProgramNode& program, FunctionDeclNode& func, std::vector<Diagnostic>& diagnostics) {
+    if (func.pendingBody.empty()) return;
+    Parser parser(func.pendingBody, program.types, func.pendingLine, func.pendingColumn);
+    parser.m_arena = program.arena;
+    parser.m_lazy = true;
+    parser.m_base = func.pendingOffset;
+    func.pendingBody = {};
+    while (!parser.atEnd()) {
+      if (ASTNode* const stmt = parser.parseNext()) func.body.push_back(stmt);
+    }
+    diagnostics.insert(diagnostics.end(), parser.m_diagnostics.begin(), parser.m_diagnostics.end());
+  }
+  // 現在のトークンの、解析しているソース上の位置
+  size_t getCurrentOffset() const {
+    return m_tokens.offset();
+  }
+  const std::shared_ptr<AstArena>& getArena() const {
+    return m_arena;
+  }
   size_t getCurrentPosition() {
-    return m_position;
+    return m_tokens.position();
   }
   Token getCurrentToken() {
-    return current();
+    return m_tokens.current();
   }
 private:
-  std::vector<Token> m_tokens;
-  size_t m_position;
-  const Token& current() const {
-    return m_tokens[m_position];
+  TokenStream m_tokens;
+  std::shared_ptr<AstArena> m_arena;
+  std::shared_ptr<TypeContext> m_types;
+  std::vector<Diagnostic> m_diagnostics;
+  // エラーから回復するまでの間（同じ原因で続くエラーは記録しない）
+  bool m_panic = false;
+  bool m_lazy = false;
+  // 解析しているソースの、元のソース上の先頭位置（遅延した本体を解析するときに診断の位置を直す）
+  uint32_t m_base = 0;
+  // アリーナ上にノードを構築
+  template<typename T, typename... Args>
+  T* make(Args&&... args) {
+    return m_arena->make<T>(std::forward<Args>(args)...);
   }
-  const Token& peek(const int offset = 1) const {
-    size_t pos = m_position + offset;
-    return pos < m_tokens.size() ? m_tokens[pos] : m_tokens.back();
+  // 現在のトークンの種別（分岐はこれだけを読む）
+  TokenType currentType() const {
+    return m_tokens.type();
+  }
+  TokenType peekType(const size_t offset = 1) const {
+    return m_tokens.type(offset);
+  }
+  SymbolId currentSymbol() const {
+    return m_tokens.symbol();
+  }
+  std::string_view currentValue() const {
+    return m_tokens.value();
+  }
+  int currentLine() const {
+    return m_tokens.line();
   }
   void advance() {
-    if (m_position < m_tokens.size() - 1) m_position++;
+    m_tokens.advance();
   }
   bool match(const TokenType type) {
-    if (current().type == type) {
+    if (currentType() == type) {
       advance();
       return true;
     }
     return false;
   }
-  void expect(const TokenType type, const std::string& message) {
-    if (!match(type)) {
-      throw std::runtime_error(message + " at line " + std::to_string(current().line));
+  bool expect(const TokenType type, const char* message) {
+    if (match(type)) return true;
+    error(message);
+    return false;
+  }
+  // 現在のトークンの位置にエラーを記録する（解析関数はnullptrを返して呼び出し元へ失敗を伝える）
+  std::nullptr_t error(const char* message) {
+    if (m_panic) return nullptr;
+    m_panic = true;
+    const Token token = m_tokens.current();
+    m_diagnostics.push_back({message, token.line, token.column + 1, m_base + token.offset, static_cast<uint32_t>(token.value.length())});
+    return nullptr;
+  }
+  // 文の区切り（;の後ろ、ブロックを閉じる}の手前か後ろ、文を始めるキーワードの手前）まで読み飛ばす
+  // 波括弧の中は数えながら読み飛ばし、入れ子になったブロックの途中では止まらない
+  void synchronize(const size_t start) {
+    // 1つも読み進めていなければ、原因のトークンを読み飛ばして先へ進む
+    if (m_tokens.position() == start) advance();
+    size_t depth = 0;
+    while (!atEnd()) {
+      const TokenType type = currentType();
+      if (type == TokenType::LBrace) {
+        ++depth;
+      } else if (type == TokenType::RBrace) {
+        if (depth == 0) break;
+        advance();
+        if (--depth == 0) break;
+        continue;
+      } else if (depth == 0) {
+        if (type == TokenType::Semicolon) {
+          advance();
+          break;
+        }
+        if (type == TokenType::Funkcio || type == TokenType::Klaso || type == TokenType::Se || type == TokenType::Dum
+            || type == TokenType::Reveni || (isVarDecl() && peekType() == TokenType::Identifier)) {
+          break;
+        }
+      }
+      advance();
+    }
+    m_panic = false;
+  }
+  // { 文... } を読む（エラーになった文は読み飛ばして続ける）
+  bool parseBlock(ArenaVector<ASTNode*>& body) {
+    if (!expect(TokenType::LBrace, "Expected '{'")) return false;
+    while (!match(TokenType::RBrace)) {
+      if (atEnd()) {
+        error("Expected '}'");
+        return false;
+      }
+      if (ASTNode* const stmt = parseNext()) body.push_back(stmt);
     }
+    return true;
   }
-  std::shared_ptr<Type> parseType() {
-    const TokenType t = current().type;
+  // 対応する}まで読み飛ばして本体の範囲を記録する（文字列の中の波括弧はトークン化で除かれる）
+  bool skipBody(FunctionDeclNode* func) {
+    if (currentType() != TokenType::LBrace) {
+      error("Expected '{'");
+      return false;
+    }
+    const Token open = m_tokens.current();
+    advance();
+    for (size_t depth = 1; ; advance()) {
+      const TokenType type = currentType();
+      if (type == TokenType::EndOfFile) {
+        error("Expected '}'");
+        return false;
+      }
+      if (type == TokenType::LBrace) ++depth;
+      else if (type == TokenType::RBrace && --depth == 0) break;
+    }
+    // 波括弧のトークンはソースを直接指すので、その間がそのまま本体のソースになる
+    const char* const begin = open.value.data() + 1;
+    func->pendingBody = std::string_view(begin, static_cast<size_t>(currentValue().data() - begin));
+    func->pendingOffset = m_base + open.offset + 1;
+    func->pendingLine = open.line;
+    func->pendingColumn = open.column + 1;
     advance();
-    switch (t) {
+    return true;
+  }
+  const Type* parseType() {
+    const Type* type = nullptr;
+    switch (currentType()) {
       case TokenType::Entjera:
-        return std::make_shared<Type>(TypeKind::Entjera);
+        type = TypeContext::primitive(TypeKind::Entjera);
+        break;
       case TokenType::Reala:
-        return std::make_shared<Type>(TypeKind::Reala);
+        type = TypeContext::primitive(TypeKind::Reala);
+        break;
       case TokenType::Teksta:
-        return std::make_shared<Type>(TypeKind::Teksta);
+        type = TypeContext::primitive(TypeKind::Teksta);
+        break;
       case TokenType::Bulea:
-        return std::make_shared<Type>(TypeKind::Bulea);
+        type = TypeContext::primitive(TypeKind::Bulea);
+        break;
       case TokenType::Funkcia:
-        return std::make_shared<Type>(TypeKind::Funkcia);
+        type = TypeContext::primitive(TypeKind::Funkcia);
+        break;
+      // klasoの名前
+      case TokenType::Identifier:
+        type = m_types->klass(symbolTable().name(currentSymbol()));
+        break;
       default:
-        throw std::runtime_error("Expected type");
+        return error("Expected type");
     }
+    advance();
+    return type;
   }
-  std::shared_ptr<ExprNode> parsePrimary() {
+  ExprNode* parsePrimary() {
     // 数値リテラル
-    const TokenType type = current().type;
+    const TokenType type = currentType();
     if (type == TokenType::Number) {
-      const double value = std::stod(current().value);
-      const bool isInt = current().value.contains('.');
+      const std::string_view text = currentValue();
+      // 小数点がなければ整数として読む
+      if (!text.contains('.')) {
+        int64_t value = 0;
+        if (std::from_chars(text.data(), text.data() + text.length(), value).ec != std::errc()) {
+          return error("Integer literal out of range");
+        }
+        advance();
+        return make<NumberLiteral>(value);
+      }
+      double value = 0.0;
+      std::from_chars(text.data(), text.data() + text.length(), value);
       advance();
-      return std::make_shared<NumberLiteral>(value, isInt);
+      return make<NumberLiteral>(value);
     }
     // 文字列リテラル
     if (type == TokenType::String) {
-      const std::string value = current().value;
+      const std::string_view value = m_arena->copy(currentValue());
       advance();
-      return std::make_shared<StringLiteral>(value);
+      return make<StringLiteral>(value);
     }
     // 真偽値リテラル
     if (type == TokenType::Vero) {
       advance();
-      return std::make_shared<BoolLiteral>(true);
+      return make<BoolLiteral>(true);
     }
     if (type == TokenType::Malvero) {
       advance();
-      return std::make_shared<BoolLiteral>(false);
+      return make<BoolLiteral>(false);
     }
     // アット関数 @(Type x) RetType {}
     if (match(TokenType::At)) {
       // '('
-      expect(TokenType::LParen, "Expected '(' after '@'");
+      if (!expect(TokenType::LParen, "Expected '(' after '@'")) return nullptr;
       // Type x
       const auto paramType = parseType();
-      const std::string paramName = current().value;
-      expect(TokenType::Identifier, "Expected parameter name");
+      if (!paramType) return nullptr;
+      const SymbolId paramName = currentSymbol();
+      if (!expect(TokenType::Identifier, "Expected parameter name")) return nullptr;
       // ')'
-      expect(TokenType::RParen, "Expected ')'");
+      if (!expect(TokenType::RParen, "Expected ')'")) return nullptr;
       // RetType
       const auto returnType = parseType();
-      auto atFunc = std::make_shared<AtFunctionNode>(
-        paramName, paramType, returnType
+      if (!returnType) return nullptr;
+      auto atFunc = make<AtFunctionNode>(
+        *m_arena, paramName, paramType, returnType
       );
-      expect(TokenType::LBrace, "Expected '{'");
-      while (!match(TokenType::RBrace)) {
-        atFunc->body.push_back(parseStatement());
-      }
+      if (!parseBlock(atFunc->body)) return nullptr;
       return atFunc;
     }
     // 丸括弧
     if (match(TokenType::LParen)) {
       auto expr = parseExpression();
-      expect(TokenType::RParen, "Expected ')'");
+      if (!expr || !expect(TokenType::RParen, "Expected ')'")) return nullptr;
       return expr;
     }
     // 変数参照
     if (type == TokenType::Identifier || type == TokenType::Tiu) {
-      const std::string name = current().value;
+      const SymbolId name = currentSymbol();
       advance();
-      return std::make_shared<VarRefNode>(name);
+      return make<VarRefNode>(name);
     }
-    throw std::runtime_error("Unexpected token in expression");
+    return error("Unexpected token in expression");
   }
-  std::shared_ptr<ExprNode> parsePostfix() {
+  ExprNode* parsePostfix() {
     auto expr = parsePrimary();
+    if (!expr) return nullptr;
     while (true) {
       // 関数呼び出し
       if (match(TokenType::LParen)) {
         auto arg = parseExpression();
-        expect(TokenType::RParen, "Expected ')'");
-        expr = std::make_shared<CallNode>(expr, arg);
+        if (!arg || !expect(TokenType::RParen, "Expected ')'")) return nullptr;
+        expr = make<CallNode>(expr, arg);
       }
       // メンバーアクセス
       else if (match(TokenType::Dot)) {
-        const std::string member = current().value;
-        expect(TokenType::Identifier, "Expected member name");
-        expr = std::make_shared<MemberAccessNode>(expr, member);
+        const SymbolId member = currentSymbol();
+        if (!expect(TokenType::Identifier, "Expected member name")) return nullptr;
+        expr = make<MemberAccessNode>(expr, member);
       }
       else {
         break;
@@ -144,137 +343,147 @@ private:
     }
     return expr;
   }
-  std::shared_ptr<ExprNode> parseMultiplicative() {
+  // 二項演算子を結合力の順に組み立てる（優先順位の段ごとに関数を呼ばないので、演算子を足しても呼び出しは深くならない）
+  // minPowerより弱い演算子の手前で止まり、同じ結合力の演算子は左結合にする
+  ExprNode* parseExpression(const uint8_t minPower = 1) {
     auto left = parsePostfix();
-    while (current().type == TokenType::Multiply || current().type == TokenType::Divide) {
-      const auto op = current().type == TokenType::Multiply ?
-        BinaryOpNode::OpType::Mul : BinaryOpNode::OpType::Div;
+    if (!left) return nullptr;
+    while (true) {
+      const BinaryOperator& binary = BinaryOperators[static_cast<size_t>(currentType())];
+      if (binary.power < minPower) break;
       advance();
-      const auto right = parsePostfix();
-      left = std::make_shared<BinaryOpNode>(op, left, right);
+      const auto right = parseExpression(binary.power + 1);
+      if (!right) return nullptr;
+      left = make<BinaryOpNode>(binary.op, left, right);
     }
     return left;
   }
-  std::shared_ptr<ExprNode> parseAdditive() {
-    auto left = parseMultiplicative();
-    while (current().type == TokenType::Plus || current().type == TokenType::Minus) {
-      const auto op = current().type == TokenType::Plus ?
-        BinaryOpNode::OpType::Add : BinaryOpNode::OpType::Sub;
-      advance();
-      const auto right = parseMultiplicative();
-      left = std::make_shared<BinaryOpNode>(op, left, right);
+  bool isVarDecl() const {
+    switch (currentType()) {
+      case TokenType::Entjera: case TokenType::Reala: case TokenType::Teksta:
+      case TokenType::Bulea: case TokenType::Funkcia:
+        return true;
+      case TokenType::Identifier:
+        return peekType() == TokenType::Identifier;
+      default:
+        return false;
     }
-    return left;
   }
-  std::shared_ptr<ExprNode> parseComparison() {
-    auto left = parseAdditive();
-    while (current().type == TokenType::Less || current().type == TokenType::Greater
-        || current().type == TokenType::LessEqual || current().type == TokenType::GreaterEqual
-        || current().type == TokenType::Equal || current().type == TokenType::NotEqual) {
-      BinaryOpNode::OpType op;
-      switch (current().type) {
-        case TokenType::Less: op = BinaryOpNode::OpType::LT; break;
-        case TokenType::Greater: op = BinaryOpNode::OpType::GT; break;
-        case TokenType::LessEqual: op = BinaryOpNode::OpType::LE; break;
-        case TokenType::GreaterEqual: op = BinaryOpNode::OpType::GE; break;
-        case TokenType::Equal: op = BinaryOpNode::OpType::Eq; break;
-        case TokenType::NotEqual: op = BinaryOpNode::OpType::NEq; break;
-        default: throw std::runtime_error("Unknown operator");
-      }
-      advance();
-      const auto right = parseAdditive();
-      left = std::make_shared<BinaryOpNode>(op, left, right);
+  VarDeclNode* parseVarDecl() {
+    const auto typeVariable = parseType();
+    if (!typeVariable) return nullptr;
+    const SymbolId name = currentSymbol();
+    if (!expect(TokenType::Identifier, "Expected variable name")) return nullptr;
+    ExprNode* init = nullptr;
+    if (match(TokenType::Assign)) {
+      init = parseExpression();
+      if (!init) return nullptr;
     }
-    return left;
+    if (!expect(TokenType::Semicolon, "Expected ';'")) return nullptr;
+    return make<VarDeclNode>(name, typeVariable, init);
   }
-  std::shared_ptr<ExprNode> parseExpression() {
-    return parseComparison();
-  }
-  std::shared_ptr<ASTNode> parseStatement() {
-    const TokenType type = current().type;
-    // 変数宣言
-    if (type == TokenType::Entjera
-     || type == TokenType::Reala
-     || type == TokenType::Teksta
-     || type == TokenType::Bulea
-     || type == TokenType::Funkcia) {
-      const auto typeVariable = parseType();
-      std::string name = current().value;
-      expect(TokenType::Identifier, "Expected variable name");
-      std::shared_ptr<ExprNode> init = nullptr;
-      if (match(TokenType::Assign)) {
-        init = parseExpression();
+  // funkcioの後ろから
+  FunctionDeclNode* parseFunctionDecl() {
+    const SymbolId name = currentSymbol();
+    if (!expect(TokenType::Identifier, "Expected function name")) return nullptr;
+    if (!expect(TokenType::LParen, "Expected '('")) return nullptr;
+    const auto paramType = parseType();
+    if (!paramType) return nullptr;
+    const SymbolId paramName = currentSymbol();
+    if (!expect(TokenType::Identifier, "Expected parameter name")) return nullptr;
+    if (!expect(TokenType::RParen, "Expected ')'")) return nullptr;
+    const auto returnType = parseType();
+    if (!returnType) return nullptr;
+    auto func = make<FunctionDeclNode>(
+      *m_arena, name, paramName, paramType, returnType
+    );
+    if (m_lazy ? !skipBody(func) : !parseBlock(func->body)) return nullptr;
+    return func;
+  }
+  // klasoの後ろから（エラーになったメンバーは読み飛ばして続ける）
+  ClassDeclNode* parseClassDecl() {
+    const SymbolId name = currentSymbol();
+    if (!expect(TokenType::Identifier, "Expected klaso name")) return nullptr;
+    const auto classDecl = make<ClassDeclNode>(*m_arena, name, m_types->klass(symbolTable().name(name)));
+    if (!expect(TokenType::LBrace, "Expected '{'")) return nullptr;
+    while (!match(TokenType::RBrace)) {
+      if (atEnd()) return error("Expected '}'");
+      const size_t start = m_tokens.position();
+      if (match(TokenType::Funkcio)) {
+        if (const auto method = parseFunctionDecl()) {
+          classDecl->methods.push_back(method);
+          continue;
+        }
+      } else if (isVarDecl()) {
+        if (const auto field = parseVarDecl()) {
+          classDecl->fields.push_back(field);
+          continue;
+        }
+      } else {
+        error("Expected field or method");
       }
-      expect(TokenType::Semicolon, "Expected ';'");
-      return std::make_shared<VarDeclNode>(name, typeVariable, init);
+      synchronize(start);
+    }
+    return classDecl;
+  }
+  ASTNode* parseStatement() {
+    // 変数宣言（klaso型は「名前 名前」で始まる）
+    if (isVarDecl()) {
+      return parseVarDecl();
     }
     // 関数宣言 funkcio name(Type param) RetType {}
     if (match(TokenType::Funkcio)) {
-      const std::string name = current().value;
-      expect(TokenType::Identifier, "Expected function name");
-      expect(TokenType::LParen, "Expected '('");
-      const auto paramType = parseType();
-      const std::string paramName = current().value;
-      expect(TokenType::Identifier, "Expected parameter name");
-      expect(TokenType::RParen, "Expected ')'");
-      const auto returnType = parseType();
-      auto func = std::make_shared<FunctionDeclNode>(
-        name, paramName, paramType, returnType
-      );
-      expect(TokenType::LBrace, "Expected '{'");
-      while (!match(TokenType::RBrace)) {
-        func->body.push_back(parseStatement());
-      }
-      return func;
+      return parseFunctionDecl();
+    }
+    // クラス宣言 klaso Name { Type field; funkcio method(Type param) RetType {} }
+    if (match(TokenType::Klaso)) {
+      return parseClassDecl();
     }
     // reveni文
     if (match(TokenType::Reveni)) {
       const auto value = parseExpression();
-      expect(TokenType::Semicolon, "Expected ';'");
-      return std::make_shared<ReturnNode>(value);
+      if (!value || !expect(TokenType::Semicolon, "Expected ';'")) return nullptr;
+      return make<ReturnNode>(value);
     }
     // se文
     if (match(TokenType::Se)) {
-      expect(TokenType::LParen, "Expected '('");
+      if (!expect(TokenType::LParen, "Expected '('")) return nullptr;
       const auto condition = parseExpression();
-      expect(TokenType::RParen, "Expected ')'");
-      const auto ifNode = std::make_shared<IfNode>(condition);
-      expect(TokenType::LBrace, "Expected '{'");
-      while (!match(TokenType::RBrace)) {
-        ifNode->thenBody.push_back(parseStatement());
-      }
-      if (match(TokenType::Alie)) {
-        expect(TokenType::LBrace, "Expected '{'");
-        while (!match(TokenType::RBrace)) {
-          ifNode->elseBody.push_back(parseStatement());
-        }
-      }
+      if (!condition || !expect(TokenType::RParen, "Expected ')'")) return nullptr;
+      const auto ifNode = make<IfNode>(*m_arena, condition);
+      if (!parseBlock(ifNode->thenBody)) return nullptr;
+      if (match(TokenType::Alie) && !parseBlock(ifNode->elseBody)) return nullptr;
       return ifNode;
     }
     // dum文
     if (match(TokenType::Dum)) {
-      expect(TokenType::LParen, "Expected '('");
+      if (!expect(TokenType::LParen, "Expected '('")) return nullptr;
       const auto condition = parseExpression();
-      expect(TokenType::RParen, "Expected ')'");
-      const auto whileNode = std::make_shared<WhileNode>(condition);
-      expect(TokenType::LBrace, "Expected '{");
-      while (!match(TokenType::RBrace)) {
-        whileNode->body.push_back(parseStatement());
-      }
+      if (!condition || !expect(TokenType::RParen, "Expected ')'")) return nullptr;
+      const auto whileNode = make<WhileNode>(*m_arena, condition);
+      if (!parseBlock(whileNode->body)) return nullptr;
       return whileNode;
     }
     // 式と文
     const auto expr = parseExpression();
+    if (!expr) return nullptr;
     // 代入
-    if (auto varRef = std::dynamic_pointer_cast<VarRefNode>(expr)) {
+    if (const auto varRef = nodeCast<VarRefNode>(expr)) {
+      if (match(TokenType::Assign)) {
+        const auto value = parseExpression();
+        if (!value || !expect(TokenType::Semicolon, "Expected ';'")) return nullptr;
+        return make<AssignNode>(varRef->name, value);
+      }
+    }
+    // メンバーへの代入
+    if (const auto member = nodeCast<MemberAccessNode>(expr)) {
       if (match(TokenType::Assign)) {
         const auto value = parseExpression();
-        expect(TokenType::Semicolon, "Expected ';'");
-        return std::make_shared<AssignNode>(varRef->name, value);
+        if (!value || !expect(TokenType::Semicolon, "Expected ';'")) return nullptr;
+        return make<MemberAssignNode>(member->object, member->member, value);
       }
     }
-    expect(TokenType::Semicolon, "Expected ';'");
+    if (!expect(TokenType::Semicolon, "Expected ';'")) return nullptr;
     return expr;
   }
 };
-
@@ -0,0 +1,125 @@
+# pragma once
+# include <atomic>
+# include <chrono>
+# include <cstddef>
+# include <cstdint>
+# include <cstdlib>
+# include <format>
+# include <new>
+# include <string>
+# include <string_view>
+# include <utility>
+# include <vector>
+
+// グローバルのoperator newを通った確保の回数とバイト数
+// ESPERO_COUNT_ALLOCATIONSを定義してこのヘッダを読む翻訳単位（プログラムに1つだけ）がoperator newを置き換え、
+// enabledの間だけ数える（数えないときは共有のカウンタに触れない）
+struct AllocationCounter {
+  inline static std::atomic<bool> enabled{false};
+  inline static std::atomic<uint64_t> count{0};
+  inline static std::atomic<uint64_t> bytes{0};
+};
+
+# ifdef ESPERO_COUNT_ALLOCATIONS
+// 呼び出し元へ展開されるとnew[]とdelete[]やnewとfreeの組み合わせを誤って警告されるので、new[]とdeleteは展開しない
+void* operator new(const size_t size) {
+  if (AllocationCounter::enabled.load(std::memory_order_relaxed)) {
+    AllocationCounter::count.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter::bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  if (void* const memory = std::malloc(size ? size : 1)) return memory;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void* operator new[](const size_t size) {
+  return ::operator new(size);
+}
+[[gnu::noinline]] void operator delete(void* const memory) noexcept {
+  std::free(memory);
+}
+[[gnu::noinline]] void operator delete[](void* const memory) noexcept {
+  std::free(memory);
+}
+[[gnu::noinline]] void operator delete(void* const memory, size_t) noexcept {
+  std::free(memory);
+}
+[[gnu::noinline]] void operator delete[](void* const memory, size_t) noexcept {
+  std::free(memory);
+}
+# endif
+
+// 処理のフェーズごとの経過時間と確保
+class Profiler {
+public:
+  struct Phase {
+    std::string name;
+    std::chrono::nanoseconds time;
+    uint64_t allocations;
+    uint64_t bytes;
+    // フェーズが処理した単位の数と名前（トークン数・ノード数など、なければ0）
+    uint64_t items = 0;
+    std::string_view unit;
+  };
+  // fを実行して計測し、fの結果を返す
+  template<typename F>
+  decltype(auto) measure(std::string name, F&& f) {
+    const Snapshot start = snapshot();
+    struct Record {
+      Profiler& profiler;
+      std::string name;
+      Snapshot start;
+      // fが例外を投げても計測したところまでは残す
+      ~Record() {
+        const Snapshot end = snapshot();
+        profiler.m_phases.push_back(Phase{std::move(name), end.time - start.time, end.allocations - start.allocations, end.bytes - start.bytes, 0, {}});
+      }
+    } record{*this, std::move(name), start};
+    return std::forward<F>(f)();
+  }
+  // 直前に計測したフェーズが処理した数
+  void items(const uint64_t count, const std::string_view unit) {
+    if (m_phases.empty()) return;
+    m_phases.back().items = count;
+    m_phases.back().unit = unit;
+  }
+  const std::vector<Phase>& phases() const {
+    return m_phases;
+  }
+  // フェーズごとに1行の表
+  std::string report() const {
+    std::string out;
+    std::format_to(std::back_inserter(out), "{:<12} {:>10} {:>10} {:>12}\n", "phase", "time(ms)", "allocs", "bytes");
+    std::chrono::nanoseconds total{0};
+    for (const Phase& phase : m_phases) {
+      total += phase.time;
+      std::format_to(std::back_inserter(out), "{:<12} {:>10.3f} {:>10} {:>12}", phase.name, milliseconds(phase.time), phase.allocations, phase.bytes);
+      if (phase.items > 0) {
+        std::format_to(std::back_inserter(out), "  {} {} ({:.0f} {}/s)", phase.items, phase.unit, rate(phase.items, phase.time), phase.unit);
+      }
+      out += '\n';
+    }
+    std::format_to(std::back_inserter(out), "{:<12} {:>10.3f}\n", "total", milliseconds(total));
+    return out;
+  }
+  static double milliseconds(const std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+  }
+  // 1秒あたりの数（時間が測れないほど短ければ0）
+  static double rate(const uint64_t count, const std::chrono::nanoseconds time) {
+    return time.count() > 0 ? static_cast<double>(count) / std::chrono::duration<double>(time).count() : 0.0;
+  }
+private:
+  struct Snapshot {
+    std::chrono::steady_clock::time_point time;
+    uint64_t allocations;
+    uint64_t bytes;
+  };
+  std::vector<Phase> m_phases;
+
+  static Snapshot snapshot() {
+    return Snapshot{
+      std::chrono::steady_clock::now(),
+      AllocationCounter::count.load(std::memory_order_relaxed),
+      AllocationCounter::bytes.load(std::memory_order_relaxed)
+    };
+  }
+};
@@ -0,0 +1,243 @@
+# pragma once
+# include <deque>
+# include <stdexcept>
+# include <unordered_map>
+# include <vector>
+
+# include "ast.hpp"
+
+// 変数参照を格納位置へ解決する
+// 関数ごとに1つのフレームを持ち、ブロックは名前の可視範囲だけを区切る
+// トップレベルの変数は直接参照し、外側の関数の変数は使うものだけをクロージャへ捕捉する
+// klasoのメソッドはtiuだけを持つ関数の内側として解決する（tiuは捕捉0番になる）
+class Resolver {
+public:
+  void resolve(ProgramNode& program) {
+    pushFunction(nullptr);
+    for (ASTNode* stmt : program.statements) resolveStatement(stmt);
+    program.frameSize = popFunction();
+  }
+private:
+  struct Variable {
+    uint32_t slot;
+    // 宣言された関数の深さ（0がトップレベル）
+    uint32_t level;
+    // funkcioで宣言された名前（再代入できない）
+    bool isFunction;
+    bool captured = false;
+    bool assigned = false;
+    // この変数を指すSlotの箱フラグ（宣言した関数を抜けるときに確定する）
+    std::vector<bool*> boxedFlags;
+  };
+  struct FunctionScope {
+    std::vector<std::unordered_map<SymbolId, Variable*>> blocks;
+    std::deque<Variable> variables;
+    // 捕捉した変数（添字が捕捉番号）
+    std::vector<Variable*> captured;
+    // funkcioの自分自身の名前
+    const Variable* self;
+    uint32_t frameSize = 0;
+  };
+  // 変数へのポインタを保つため要素の移動しないdequeに置く
+  std::deque<FunctionScope> m_functions;
+  const SymbolId m_tiu = symbolTable().intern("tiu");
+
+  uint32_t level() const {
+    return static_cast<uint32_t>(m_functions.size() - 1);
+  }
+  void pushFunction(const Variable* self) {
+    m_functions.emplace_back();
+    m_functions.back().blocks.emplace_back();
+    m_functions.back().self = self;
+  }
+  uint32_t popFunction() {
+    FunctionScope& function = m_functions.back();
+    // 捕捉されたうえで代入される変数だけを箱に入れる
+    for (const Variable& variable : function.variables) {
+      if (!variable.captured || !variable.assigned) continue;
+      for (bool* boxed : variable.boxedFlags) *boxed = true;
+    }
+    const uint32_t size = function.frameSize;
+    m_functions.pop_back();
+    return size;
+  }
+  // 現在のブロックに変数を宣言する（同名の再宣言は新しいスロットで隠す）
+  Variable* declare(const SymbolId name, const bool isFunction = false) {
+    FunctionScope& function = m_functions.back();
+    Variable& variable = function.variables.emplace_back(Variable{function.frameSize++, level(), isFunction, false, false, {}});
+    function.blocks.back()[name] = &variable;
+    return &variable;
+  }
+  // 宣言した変数の格納位置を設定する
+  static void declared(Variable* variable, Slot& slot) {
+    slot = Slot{variable->level == 0 ? Storage::Global : Storage::Local, false, variable->slot};
+    variable->boxedFlags.push_back(&slot.boxed);
+  }
+  Variable* find(const SymbolId name) {
+    for (auto function = m_functions.rbegin(); function != m_functions.rend(); ++function) {
+      for (auto block = function->blocks.rbegin(); block != function->blocks.rend(); ++block) {
+        const auto iter = block->find(name);
+        if (iter != block->end()) return iter->second;
+      }
+    }
+    throw std::runtime_error("Undefined variable " + std::string(symbolTable().name(name)));
+  }
+  // 深さlevelの関数から見た外側の変数の位置（未捕捉なら捕捉に加える）
+  Slot captureSlot(const uint32_t level, Variable* variable) {
+    FunctionScope& function = m_functions[level];
+    if (function.self == variable) return Slot{Storage::Self, false, 0};
+    for (uint32_t i = 0; i < function.captured.size(); ++i) {
+      if (function.captured[i] == variable) return Slot{Storage::Capture, false, i};
+    }
+    function.captured.push_back(variable);
+    return Slot{Storage::Capture, false, static_cast<uint32_t>(function.captured.size() - 1)};
+  }
+  void bind(Slot& slot, const SymbolId name, const bool assign) {
+    Variable* variable = find(name);
+    if (assign) {
+      if (name == m_tiu) throw std::runtime_error("Cannot assign to tiu");
+      if (variable->isFunction) {
+        throw std::runtime_error("Cannot assign to funkcio " + std::string(symbolTable().name(name)));
+      }
+      variable->assigned = true;
+    }
+    if (variable->level == 0) {
+      slot = Slot{Storage::Global, false, variable->slot};
+      return;
+    }
+    if (variable->level == level()) {
+      slot = Slot{Storage::Local, false, variable->slot};
+    } else {
+      slot = captureSlot(level(), variable);
+      if (slot.storage == Storage::Self) return;
+      variable->captured = true;
+    }
+    variable->boxedFlags.push_back(&slot.boxed);
+  }
+  void resolveBlock(ArenaVector<ASTNode*>& body) {
+    m_functions.back().blocks.emplace_back();
+    for (ASTNode* stmt : body) resolveStatement(stmt);
+    m_functions.back().blocks.pop_back();
+  }
+  // 関数本体を新しいフレームで解決し、捕捉した変数の取り出し元を設定する
+  uint32_t resolveFunction(const SymbolId paramName, ArenaVector<ASTNode*>& body,
+                           ArenaVector<Slot>& captures, bool& paramBoxed, const Variable* self) {
+    pushFunction(self);
+    declare(paramName)->boxedFlags.push_back(&paramBoxed);
+    for (ASTNode* stmt : body) resolveStatement(stmt);
+    // 取り出し元は1つ外側の関数から見た位置（値をそのままコピーする）
+    const uint32_t outer = level() - 1;
+    captures.clear();
+    for (Variable* variable : m_functions.back().captured) {
+      captures.push_back(variable->level == outer
+        ? Slot{Storage::Local, false, variable->slot}
+        : captureSlot(outer, variable));
+    }
+    return popFunction();
+  }
+  void resolveStatement(ASTNode* node) {
+    switch (node->kind) {
+      case NodeKind::VarDecl: {
+        auto* decl = static_cast<VarDeclNode*>(node);
+        // 初期化式は宣言より前のスコープで解決する
+        if (decl->initializer) resolveExpression(decl->initializer);
+        declared(declare(decl->name), decl->slot);
+        break;
+      }
+      case NodeKind::Assign: {
+        auto* assign = static_cast<AssignNode*>(node);
+        resolveExpression(assign->value);
+        bind(assign->slot, assign->name, true);
+        break;
+      }
+      case NodeKind::FunctionDecl: {
+        auto* func = static_cast<FunctionDeclNode*>(node);
+        // 再帰呼び出しのため本体より先に名前を宣言する
+        Variable* self = declare(func->name, true);
+        declared(self, func->slot);
+        func->frameSize = resolveFunction(func->paramName, func->body, func->captures, func->paramBoxed, self);
+        break;
+      }
+      case NodeKind::Return:
+        resolveExpression(static_cast<ReturnNode*>(node)->value);
+        break;
+      case NodeKind::If: {
+        auto* ifNode = static_cast<IfNode*>(node);
+        resolveExpression(ifNode->condition);
+        resolveBlock(ifNode->thenBody);
+        resolveBlock(ifNode->elseBody);
+        break;
+      }
+      case NodeKind::While: {
+        auto* whileNode = static_cast<WhileNode*>(node);
+        resolveExpression(whileNode->condition);
+        resolveBlock(whileNode->body);
+        break;
+      }
+      case NodeKind::Block:
+        resolveBlock(static_cast<BlockNode*>(node)->body);
+        break;
+      case NodeKind::MemberAssign: {
+        auto* assign = static_cast<MemberAssignNode*>(node);
+        resolveExpression(assign->object);
+        resolveExpression(assign->value);
+        break;
+      }
+      case NodeKind::ClassDecl:
+        resolveClass(static_cast<ClassDeclNode*>(node));
+        break;
+      default:
+        resolveExpression(static_cast<ExprNode*>(node));
+    }
+  }
+  void resolveClass(ClassDeclNode* node) {
+    if (level() != 0) throw std::runtime_error("klaso must be declared at the top level");
+    for (size_t i = 0; i < node->fields.size() + node->methods.size(); ++i) {
+      const SymbolId member = i < node->fields.size() ? node->fields[i]->name : node->methods[i - node->fields.size()]->name;
+      if (node->find(member) != static_cast<int32_t>(i)) {
+        throw std::runtime_error("Duplicate member " + std::string(symbolTable().name(member)) + " of klaso " + std::string(symbolTable().name(node->name)));
+      }
+    }
+    // フィールドの初期化式はインスタンスを作る箇所で評価するのでトップレベルの変数だけを参照する
+    for (VarDeclNode* field : node->fields) {
+      if (field->initializer) resolveExpression(field->initializer);
+    }
+    pushFunction(nullptr);
+    declare(m_tiu);
+    for (FunctionDeclNode* method : node->methods) {
+      method->frameSize = resolveFunction(method->paramName, method->body, method->captures, method->paramBoxed, nullptr);
+    }
+    popFunction();
+  }
+  void resolveExpression(ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::VarRef: {
+        auto* ref = static_cast<VarRefNode*>(node);
+        bind(ref->slot, ref->name, false);
+        break;
+      }
+      case NodeKind::BinaryOp: {
+        auto* binary = static_cast<BinaryOpNode*>(node);
+        resolveExpression(binary->left);
+        resolveExpression(binary->right);
+        break;
+      }
+      case NodeKind::Call: {
+        auto* call = static_cast<CallNode*>(node);
+        resolveExpression(call->function);
+        resolveExpression(call->argument);
+        break;
+      }
+      case NodeKind::AtFunction: {
+        auto* atFunc = static_cast<AtFunctionNode*>(node);
+        atFunc->frameSize = resolveFunction(atFunc->paramName, atFunc->body, atFunc->captures, atFunc->paramBoxed, nullptr);
+        break;
+      }
+      case NodeKind::MemberAccess:
+        resolveExpression(static_cast<MemberAccessNode*>(node)->object);
+        break;
+      default:
+        break;
+    }
+  }
+};
@@ -0,0 +1,208 @@
+# pragma once
+# include <cstddef>
+# include <cstdint>
+# include <bit>
+# if defined(__AVX2__) || defined(__SSE2__)
+#   include <immintrin.h>
+# elif defined(__ARM_NEON)
+#   include <arm_neon.h>
+# endif
+
+// トークナイザ用の一括走査（SIMDが使えない環境ではスカラーで走査する）
+namespace scan {
+  // 空白文字（Cロケールのisspaceと同じ集合）
+  constexpr bool isSpace(const char c) {
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+  }
+  // 識別子を構成する文字
+  constexpr bool isIdentifier(const char c) {
+    return static_cast<unsigned char>((c | 0x20) - 'a') <= 'z' - 'a'
+        || static_cast<unsigned char>(c - '0') <= 9
+        || c == '_';
+  }
+  // 行末（コメントの終わり）
+  constexpr bool isLineEnd(const char c) {
+    return c == '\n' || c == '\0';
+  }
+  // 文字列・コメントの境界判定に関わる文字
+  constexpr bool isBoundary(const char c) {
+    return isLineEnd(c) || c == '"' || c == '\\' || c == '/';
+  }
+
+# if defined(__AVX2__)
+  using Block = __m256i;
+  constexpr size_t BlockSize = 32;
+  inline Block load(const char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  inline Block splat(const char c) {
+    return _mm256_set1_epi8(c);
+  }
+  inline Block equal(const Block a, const Block b) {
+    return _mm256_cmpeq_epi8(a, b);
+  }
+  // 符号なしで a - lo <= hi - lo
+  inline Block inRange(const Block a, const char lo, const char hi) {
+    const Block t = _mm256_sub_epi8(a, splat(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, splat(hi - lo)), t);
+  }
+  inline Block either(const Block a, const Block b) {
+    return _mm256_or_si256(a, b);
+  }
+  inline uint64_t bits(const Block m) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(m));
+  }
+  inline Block toLower(const Block a) {
+    return _mm256_or_si256(a, splat(0x20));
+  }
+# elif defined(__SSE2__)
+  using Block = __m128i;
+  constexpr size_t BlockSize = 16;
+  inline Block load(const char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  inline Block splat(const char c) {
+    return _mm_set1_epi8(c);
+  }
+  inline Block equal(const Block a, const Block b) {
+    return _mm_cmpeq_epi8(a, b);
+  }
+  // 符号なしで a - lo <= hi - lo
+  inline Block inRange(const Block a, const char lo, const char hi) {
+    const Block t = _mm_sub_epi8(a, splat(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, splat(hi - lo)), t);
+  }
+  inline Block either(const Block a, const Block b) {
+    return _mm_or_si128(a, b);
+  }
+  inline uint64_t bits(const Block m) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(m));
+  }
+  inline Block toLower(const Block a) {
+    return _mm_or_si128(a, splat(0x20));
+  }
+# elif defined(__ARM_NEON)
+  using Block = uint8x16_t;
+  constexpr size_t BlockSize = 16;
+  inline Block load(const char* p) {
+    return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  }
+  inline Block splat(const char c) {
+    return vdupq_n_u8(static_cast<uint8_t>(c));
+  }
+  inline Block equal(const Block a, const Block b) {
+    return vceqq_u8(a, b);
+  }
+  // 符号なしで a - lo <= hi - lo
+  inline Block inRange(const Block a, const char lo, const char hi) {
+    return vcleq_u8(vsubq_u8(a, splat(lo)), splat(hi - lo));
+  }
+  inline Block either(const Block a, const Block b) {
+    return vorrq_u8(a, b);
+  }
+  // 1バイトにつき1ビットのマスクへ変換
+  inline uint64_t bits(const Block m) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t masked = vandq_u8(m, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(masked)) | (static_cast<uint64_t>(vaddv_u8(vget_high_u8(masked))) << 8);
+  }
+  inline Block toLower(const Block a) {
+    return vorrq_u8(a, splat(0x20));
+  }
+# endif
+
+# if defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON)
+  # define ESPERO_SCAN_SIMD 1
+  inline uint64_t spaceMask(const Block b) {
+    return bits(either(equal(b, splat(' ')), inRange(b, '\t', '\r')));
+  }
+  inline uint64_t identifierMask(const Block b) {
+    return bits(either(either(inRange(toLower(b), 'a', 'z'), inRange(b, '0', '9')), equal(b, splat('_'))));
+  }
+  inline uint64_t lineEndMask(const Block b) {
+    return bits(either(equal(b, splat('\n')), equal(b, splat('\0'))));
+  }
+  inline uint64_t boundaryMask(const Block b) {
+    return bits(either(either(equal(b, splat('\n')), equal(b, splat('\0'))),
+      either(either(equal(b, splat('"')), equal(b, splat('\\'))), equal(b, splat('/')))));
+  }
+  constexpr uint64_t FullMask = BlockSize == 64 ? ~uint64_t{0} : (uint64_t{1} << BlockSize) - 1;
+# endif
+
+  // [p, end) で pred を満たす文字が続く長さ
+  template<typename Pred, typename Mask>
+  inline size_t span(const char* p, const char* end, Pred pred, [[maybe_unused]] Mask mask) {
+    const char* const begin = p;
+# if defined(ESPERO_SCAN_SIMD)
+    while (static_cast<size_t>(end - p) >= BlockSize) {
+      const uint64_t m = mask(load(p));
+      if (m != FullMask) return (p - begin) + std::countr_one(m);
+      p += BlockSize;
+    }
+# endif
+    while (p < end && pred(*p)) ++p;
+    return p - begin;
+  }
+
+  // 空白文字の連続長
+  inline size_t whitespace(const char* p, const char* end) {
+# if defined(ESPERO_SCAN_SIMD)
+    return span(p, end, isSpace, spaceMask);
+# else
+    return span(p, end, isSpace, nullptr);
+# endif
+  }
+  // 識別子の長さ
+  inline size_t identifier(const char* p, const char* end) {
+# if defined(ESPERO_SCAN_SIMD)
+    return span(p, end, isIdentifier, identifierMask);
+# else
+    return span(p, end, isIdentifier, nullptr);
+# endif
+  }
+  // 行末（改行かNUL）までの長さ
+  inline size_t untilLineEnd(const char* p, const char* end) {
+    const auto notLineEnd = [](const char c) { return !isLineEnd(c); };
+# if defined(ESPERO_SCAN_SIMD)
+    return span(p, end, notLineEnd, [](const Block b) { return ~lineEndMask(b) & FullMask; });
+# else
+    return span(p, end, notLineEnd, nullptr);
+# endif
+  }
+
+  // 境界判定に関わる文字が現れるまでの長さ
+  inline size_t untilBoundary(const char* p, const char* end) {
+    const auto notBoundary = [](const char c) { return !isBoundary(c); };
+# if defined(ESPERO_SCAN_SIMD)
+    return span(p, end, notBoundary, [](const Block b) { return ~boundaryMask(b) & FullMask; });
+# else
+    return span(p, end, notBoundary, nullptr);
+# endif
+  }
+
+  // 改行の数と最後の改行の位置
+  struct Newlines {
+    size_t count = 0;
+    size_t last = 0;
+  };
+  inline Newlines newlines(const char* p, const size_t length) {
+    Newlines result;
+    size_t i = 0;
+# if defined(ESPERO_SCAN_SIMD)
+    for (; i + BlockSize <= length; i += BlockSize) {
+      const uint64_t m = bits(equal(load(p + i), splat('\n')));
+      if (m) {
+        result.count += std::popcount(m);
+        result.last = i + 63 - std::countl_zero(m);
+      }
+    }
+# endif
+    for (; i < length; ++i) {
+      if (p[i] == '\n') {
+        result.count++;
+        result.last = i;
+      }
+    }
+    return result;
+  }
+}
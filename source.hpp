@@ -0,0 +1,78 @@
+# pragma once
+# include <string>
+# include <string_view>
+# include <stdexcept>
+# include <cerrno>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+
+// ソースファイル（通常ファイルはmmap、パイプや標準入力はreadで読み込む）
+class SourceFile {
+public:
+  // pathが"-"の場合は標準入力から読み込む
+  explicit SourceFile(const std::string& path) {
+    const bool isStdin = path == "-";
+    const int fd = isStdin ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open a " + path);
+    // readAllが例外を投げても開いたファイルは閉じる
+    struct Closer {
+      int fd;
+      bool owned;
+      ~Closer() {
+        if (owned) ::close(fd);
+      }
+    } closer{fd, !isStdin};
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* const addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(addr);
+        m_size = static_cast<size_t>(st.st_size);
+        m_mapped = true;
+      }
+    }
+    if (!m_mapped) readAll(fd, path);
+  }
+  ~SourceFile() {
+    if (m_mapped) ::munmap(const_cast<char*>(m_data), m_size);
+  }
+  SourceFile(const SourceFile&) = delete;
+  SourceFile& operator=(const SourceFile&) = delete;
+  SourceFile(SourceFile&& other) noexcept
+    : m_data(other.m_data), m_size(other.m_size), m_mapped(other.m_mapped), m_buffer(std::move(other.m_buffer)) {
+    other.m_mapped = false;
+    other.m_data = nullptr;
+    other.m_size = 0;
+  }
+  // ファイル内容（SourceFileの生存中のみ有効）
+  std::string_view view() const {
+    return m_mapped ? std::string_view(m_data, m_size) : std::string_view(m_buffer);
+  }
+  bool isMapped() const {
+    return m_mapped;
+  }
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+  std::string m_buffer;
+  // mmapできない入力を末尾まで読み込む
+  void readAll(const int fd, const std::string& path) {
+    constexpr size_t ChunkSize = 1 << 16;
+    size_t length = 0;
+    while (true) {
+      m_buffer.resize(length + ChunkSize);
+      const ssize_t n = ::read(fd, m_buffer.data() + length, ChunkSize);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("Failed to read a " + path);
+      }
+      if (n == 0) break;
+      length += static_cast<size_t>(n);
+    }
+    m_buffer.resize(length);
+  }
+};
@@ -0,0 +1,56 @@
+# pragma once
+# include <cstdint>
+# include <mutex>
+# include <shared_mutex>
+# include <string_view>
+# include <unordered_map>
+# include <vector>
+
+# include "arena.hpp"
+
+// internされた識別子
+using SymbolId = uint32_t;
+
+// 識別子のintern表（同じ名前には常に同じSymbolIdを返す）
+// 複数のスレッドから同時に使える（既存の名前の検索は共有ロックだけで済ませる）
+class SymbolTable {
+public:
+  SymbolTable() = default;
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+  SymbolId intern(const std::string_view name) {
+    {
+      const std::shared_lock lock(m_mutex);
+      const auto iter = m_ids.find(name);
+      if (iter != m_ids.end()) return iter->second;
+    }
+    const std::unique_lock lock(m_mutex);
+    // ロックを取り直す間に他のスレッドが登録していることがある
+    const auto iter = m_ids.find(name);
+    if (iter != m_ids.end()) return iter->second;
+    const std::string_view stored = m_storage.copy(name);
+    const SymbolId id = static_cast<SymbolId>(m_names.size());
+    m_names.push_back(stored);
+    m_ids.emplace(stored, id);
+    return id;
+  }
+  std::string_view name(const SymbolId id) const {
+    const std::shared_lock lock(m_mutex);
+    return m_names[id];
+  }
+  size_t size() const {
+    const std::shared_lock lock(m_mutex);
+    return m_names.size();
+  }
+private:
+  mutable std::shared_mutex m_mutex;
+  AstArena m_storage;
+  std::vector<std::string_view> m_names;
+  std::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+// プロセス全体で共有するintern表
+inline SymbolTable& symbolTable() {
+  static SymbolTable table;
+  return table;
+}
@@ -0,0 +1,114 @@
+# pragma once
+# include <atomic>
+# include <condition_variable>
+# include <deque>
+# include <exception>
+# include <functional>
+# include <memory>
+# include <mutex>
+# include <thread>
+# include <utility>
+# include <vector>
+
+// ワークスティーリングのスレッドプール
+// ワーカーごとに両端キューを持ち、自分のキューは後ろから、空なら他のワーカーのキューを前から取る
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) m_queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threads; ++i) m_workers.emplace_back([this, i] { work(i); });
+  }
+  ~ThreadPool() {
+    {
+      const std::lock_guard lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers) worker.join();
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  size_t size() const {
+    return m_workers.size();
+  }
+  // タスクをワーカーのキューへ順番に振り分ける
+  // 先に数えておき、キューに入れたタスクがすぐ終わっても数が0を下回らないようにする
+  void submit(std::function<void()> task) {
+    {
+      const std::lock_guard lock(m_mutex);
+      ++m_queued;
+      ++m_pending;
+    }
+    Queue& queue = *m_queues[m_next++ % m_queues.size()];
+    {
+      const std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    m_wake.notify_one();
+  }
+  // 投入したタスクがすべて終わるまで待つ（タスクの例外は最初の1つを投げ直す）
+  void wait() {
+    std::unique_lock lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_pending == 0; });
+    if (m_error) std::rethrow_exception(std::exchange(m_error, nullptr));
+  }
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_workers;
+  std::atomic<size_t> m_next = 0;
+  // m_mutexが守る状態（キューに残っている数と終わっていない数）
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  size_t m_queued = 0;
+  size_t m_pending = 0;
+  bool m_stop = false;
+  std::exception_ptr m_error;
+
+  bool pop(const size_t self, std::function<void()>& task) {
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      Queue& queue = *m_queues[(self + i) % m_queues.size()];
+      const std::lock_guard lock(queue.mutex);
+      if (queue.tasks.empty()) continue;
+      // 自分のキューは最近入れたものから、他のキューは古いものから取る
+      if (i == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+  void work(const size_t self) {
+    while (true) {
+      std::function<void()> task;
+      if (pop(self, task)) {
+        {
+          const std::lock_guard lock(m_mutex);
+          --m_queued;
+        }
+        std::exception_ptr error;
+        try {
+          task();
+        } catch (...) {
+          error = std::current_exception();
+        }
+        const std::lock_guard lock(m_mutex);
+        if (error && !m_error) m_error = error;
+        if (--m_pending == 0) m_idle.notify_all();
+        continue;
+      }
+      std::unique_lock lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || m_queued != 0; });
+      if (m_stop && m_queued == 0) return;
+    }
+  }
+};
@@ -1,11 +1,19 @@
 # pragma once
+# include <cstdint>
+# include <stdexcept>
 # include <string>
+# include <string_view>
 # include <vector>
+# include <array>
 # include <memory>
-# include <map>
 # include <format>
+# include <algorithm>
+# include <unordered_map>
 
-enum class TokenType {
+# include "scan.hpp"
+# include "symbol.hpp"
+
+enum class TokenType : uint8_t {
   // リテラル
   Number, String, Identifier,
   // キーワード
@@ -21,7 +29,8 @@ enum class TokenType {
 };
 
 namespace {
-  std::map<std::string, TokenType> Id2TokenType = {
+  // キーワード表
+  constexpr std::array<std::pair<std::string_view, TokenType>, 14> Id2TokenType = {{
     {"funkcio", TokenType::Funkcio},
     {"klaso", TokenType::Klaso},
     {"se", TokenType::Se},
@@ -36,58 +45,113 @@ namespace {
     {"teksta", TokenType::Teksta},
     {"bulea", TokenType::Bulea},
     {"funkcia", TokenType::Funkcia},
+  }};
+  // TokenTypeの値で引く名前表
+  constexpr std::array<std::string_view, static_cast<size_t>(TokenType::Unknown) + 1> TokenType2Stirng = {
+    "Number", "String", "Identifier",
+    "Funkcio", "Klaso", "Se", "Alie", "Dum", "Reveni", "Tiu", "Vero", "Malvero",
+    "Entjera", "Reala", "Teksta", "Bulea", "Funkcia",
+    "Plus", "Minus", "Multiply", "Divide", "Assign", "Equal", "NotEqual", "Less", "Greater", "LessEqual", "GreaterEqual",
+    "LParen", "RParen", "LBrace", "RBrace", "Semicolon", "Comma", "At", "Dot",
+    "EndOfFile", "Unknown",
   };
-  std::map<TokenType, std::string> TokenType2Stirng = {
-    {TokenType::Number, "Number"},
-    {TokenType::String, "String"},
-    {TokenType::Identifier, "Identifier"},
-    {TokenType::Funkcio, "Funkcio"},
-    {TokenType::Klaso, "Klaso"},
-    {TokenType::Se, "Se"},
-    {TokenType::Alie, "Alie"},
-    {TokenType::Dum, "Dum"},
-    {TokenType::Reveni, "Reveni"},
-    {TokenType::Tiu, "Tiu"},
-    {TokenType::Vero, "Vero"},
-    {TokenType::Malvero, "Malvero"},
-    {TokenType::Entjera, "Entjera"},
-    {TokenType::Reala, "Reala"},
-    {TokenType::Teksta, "Teksta"},
-    {TokenType::Bulea, "Bulea"},
-    {TokenType::Funkcia, "Funkcia"},
-    {TokenType::Plus, "Plus"},
-    {TokenType::Minus, "Minus"},
-    {TokenType::Multiply, "Multiply"},
-    {TokenType::Divide, "Divide"},
-    {TokenType::Assign, "Assign"},
-    {TokenType::Equal, "Equal"},
-    {TokenType::NotEqual, "NotEqual"},
-    {TokenType::Less, "Less"},
-    {TokenType::Greater, "Greater"},
-    {TokenType::LessEqual, "LessEqual"},
-    {TokenType::GreaterEqual, "GreaterEqual"},
-    {TokenType::LParen, "LParen"},
-    {TokenType::RParen, "RParen"},
-    {TokenType::LBrace, "LBrace"},
-    {TokenType::RBrace, "RBrace"},
-    {TokenType::Semicolon, "Semicolon"},
-    {TokenType::Comma, "Comma"},
-    {TokenType::At, "At"},
-    {TokenType::Dot, "Dot"},
-    {TokenType::EndOfFile, "EndOfFile"},
-    {TokenType::Unknown, "Unknown"},
+}
+
+// トークン種別の名前
+constexpr std::string_view toString(const TokenType type) {
+  return TokenType2Stirng[static_cast<size_t>(type)];
+}
+
+// キーワード判定（長さと先頭文字で候補を1つに絞ってから比較する）
+constexpr TokenType lookupKeyword(const std::string_view id) {
+  const auto keyword = [id](const std::string_view word, const TokenType type) {
+    return id == word ? type : TokenType::Identifier;
   };
+  switch (id.length()) {
+    case 2: return keyword("se", TokenType::Se);
+    case 3:
+      switch (id[0]) {
+        case 'd': return keyword("dum", TokenType::Dum);
+        case 't': return keyword("tiu", TokenType::Tiu);
+      }
+      break;
+    case 4:
+      switch (id[0]) {
+        case 'a': return keyword("alie", TokenType::Alie);
+        case 'v': return keyword("vero", TokenType::Vero);
+      }
+      break;
+    case 5:
+      switch (id[0]) {
+        case 'k': return keyword("klaso", TokenType::Klaso);
+        case 'r': return keyword("reala", TokenType::Reala);
+        case 'b': return keyword("bulea", TokenType::Bulea);
+      }
+      break;
+    case 6:
+      switch (id[0]) {
+        case 'r': return keyword("reveni", TokenType::Reveni);
+        case 't': return keyword("teksta", TokenType::Teksta);
+      }
+      break;
+    case 7:
+      switch (id[0]) {
+        case 'f': return id[6] == 'o' ? keyword("funkcio", TokenType::Funkcio) : keyword("funkcia", TokenType::Funkcia);
+        case 'm': return keyword("malvero", TokenType::Malvero);
+        case 'e': return keyword("entjera", TokenType::Entjera);
+      }
+      break;
+  }
+  return TokenType::Identifier;
 }
 
+// キーワード表と判定関数の整合性をコンパイル時に検査
+static_assert([] {
+  for (const auto& [word, type] : Id2TokenType) {
+    if (lookupKeyword(word) != type) return false;
+  }
+  return lookupKeyword("x") == TokenType::Identifier
+      && lookupKeyword("funkcix") == TokenType::Identifier
+      && lookupKeyword("sex") == TokenType::Identifier;
+}());
+
+// トークン（valueはソースバッファかStringArenaを参照する）
 struct Token {
   TokenType type;
-  std::string value;
+  std::string_view value;
+  // 識別子とtiuのintern済みの名前
+  SymbolId symbol = 0;
   int line;
   int column;
-  Token(TokenType t, const std::string& v, int l, int c)
+  // ソース上の先頭位置（文字列リテラルでは開きの"の位置）
+  uint32_t offset = 0;
+  Token(TokenType t, std::string_view v, int l, int c)
     : type(t), value(v), line(l), column(c) {}
 };
 
+// エスケープを含む文字列リテラルの退避領域
+class StringArena {
+public:
+  // size文字分の連続領域を確保
+  char* allocate(const size_t size) {
+    if (m_remaining < size) {
+      const size_t chunkSize = std::max(size, ChunkSize);
+      m_chunks.push_back(std::make_unique<char[]>(chunkSize));
+      m_cursor = m_chunks.back().get();
+      m_remaining = chunkSize;
+    }
+    char* ptr = m_cursor;
+    m_cursor += size;
+    m_remaining -= size;
+    return ptr;
+  }
+private:
+  static constexpr size_t ChunkSize = 4096;
+  std::vector<std::unique_ptr<char[]>> m_chunks;
+  char* m_cursor = nullptr;
+  size_t m_remaining = 0;
+};
+
 template<>
 struct std::formatter<Token> {
   char type = 'd';
@@ -104,38 +168,164 @@ struct std::formatter<Token> {
   }
   auto format(const Token& token, std::format_context& ctx) const {
     switch (type) {
-      case 't': return std::format_to(ctx.out(), "{}", TokenType2Stirng.at(token.type));
+      case 't': return std::format_to(ctx.out(), "{}", toString(token.type));
       case 'v': return std::format_to(ctx.out(), "{}", token.value);
       case 'l': return std::format_to(ctx.out(), "{}", token.line);
       case 'c': return std::format_to(ctx.out(), "{}", token.column);
     }
     return std::format_to(ctx.out(), "Token(l:{:04}, c:{:04}, {:>12}, \"{}\")",
-      token.line, token.column, TokenType2Stirng.at(token.type), token.value
+      token.line, token.column, toString(token.type), token.value
     );
   }
 };
 
+// トークン列を種別・位置・名前の配列に分けて持つ（パーサーの分岐は種別の配列だけを読む）
+// 行と列は保持せず、必要になったとき（エラー表示など）に行頭表から求める
+class TokenBuffer {
+public:
+  explicit TokenBuffer(std::string_view src) : m_source(src) {
+    if (src.length() > UINT32_MAX) throw std::runtime_error("Source too large for TokenBuffer");
+  }
+  void push(const Token& token) {
+    const auto index = static_cast<uint32_t>(m_types.size());
+    const size_t start = token.offset;
+    m_types.push_back(token.type);
+    m_offsets.push_back(token.offset);
+    m_lengths.push_back(static_cast<uint32_t>(token.value.length()));
+    m_symbols.push_back(token.symbol);
+    // エスケープを展開した文字列だけはソースを指さないので別に持つ
+    if (token.type == TokenType::String && token.value.data() != m_source.data() + start + 1) {
+      m_escaped.emplace(index, token.value);
+    }
+  }
+  // 別のソース区間から作った列をつなげる（baseはその区間の先頭位置、lastでなければ末尾のEndOfFileは除く）
+  void append(const TokenBuffer& part, const size_t base, const bool last) {
+    const auto index = static_cast<uint32_t>(m_types.size());
+    const size_t count = last ? part.size() : part.size() - 1;
+    m_types.insert(m_types.end(), part.m_types.begin(), part.m_types.begin() + count);
+    m_lengths.insert(m_lengths.end(), part.m_lengths.begin(), part.m_lengths.begin() + count);
+    m_symbols.insert(m_symbols.end(), part.m_symbols.begin(), part.m_symbols.begin() + count);
+    m_offsets.reserve(m_offsets.size() + count);
+    for (size_t i = 0; i < count; ++i) m_offsets.push_back(static_cast<uint32_t>(part.m_offsets[i] + base));
+    for (const auto& [i, value] : part.m_escaped) {
+      if (i < count) m_escaped.emplace(index + i, value);
+    }
+  }
+  size_t size() const {
+    return m_types.size();
+  }
+  TokenType type(const size_t i) const {
+    return m_types[i];
+  }
+  SymbolId symbol(const size_t i) const {
+    return m_symbols[i];
+  }
+  std::string_view value(const size_t i) const {
+    if (m_types[i] == TokenType::String) {
+      const auto iter = m_escaped.find(static_cast<uint32_t>(i));
+      if (iter != m_escaped.end()) return iter->second;
+      return m_source.substr(m_offsets[i] + 1, m_lengths[i]);
+    }
+    return m_source.substr(m_offsets[i], m_lengths[i]);
+  }
+  size_t offset(const size_t i) const {
+    return m_offsets[i];
+  }
+  int line(const size_t i) const {
+    const std::vector<uint32_t>& starts = lineStarts();
+    return static_cast<int>(std::ranges::upper_bound(starts, m_offsets[i]) - starts.begin());
+  }
+  int column(const size_t i) const {
+    const std::vector<uint32_t>& starts = lineStarts();
+    return static_cast<int>(m_offsets[i] - *(std::ranges::upper_bound(starts, m_offsets[i]) - 1));
+  }
+  Token token(const size_t i) const {
+    Token token{m_types[i], value(i), line(i), column(i)};
+    token.symbol = m_symbols[i];
+    token.offset = m_offsets[i];
+    return token;
+  }
+private:
+  std::string_view m_source;
+  std::vector<TokenType> m_types;
+  std::vector<uint32_t> m_offsets;
+  std::vector<uint32_t> m_lengths;
+  std::vector<SymbolId> m_symbols;
+  std::unordered_map<uint32_t, std::string_view> m_escaped;
+  // 各行の先頭位置（最初に行番号を求めたときに作る）
+  mutable std::vector<uint32_t> m_lineStarts;
+  const std::vector<uint32_t>& lineStarts() const {
+    if (m_lineStarts.empty()) {
+      m_lineStarts.push_back(0);
+      for (size_t i = 0; i < m_source.length(); ++i) {
+        if (m_source[i] == '\n') m_lineStarts.push_back(static_cast<uint32_t>(i + 1));
+      }
+    }
+    return m_lineStarts;
+  }
+};
+
 class Tokenizer {
 public:
-  Tokenizer(const std::string& src)
+  // srcは呼び出し側が保持する（トークンはsrcを参照するため）
+  Tokenizer(std::string_view src)
     : m_source(src), m_position(0), m_line(1), m_column(0) {}
+  // ソースの途中から切り出した区間を読む（行と列は切り出し位置から数える）
+  Tokenizer(std::string_view src, const int line, const int column)
+    : m_source(src), m_position(0), m_line(line), m_column(column) {}
 
-  std::vector<Token> tokenize() {
+  // トークンはこのTokenizerのアリーナも参照するため一時オブジェクトからは呼べない
+  std::vector<Token> tokenize() & {
     std::vector<Token> tokens;
+    do {
+      tokens.push_back(next());
+    } while (tokens.back().type != TokenType::EndOfFile);
+    return tokens;
+  }
+  // トークン列をTokenBufferへ読み込む（tokenizeと同じくアリーナを参照する）
+  TokenBuffer buffer() & {
+    TokenBuffer buffer(m_source);
+    TokenType type;
+    do {
+      const Token token = next();
+      type = token.type;
+      buffer.push(token);
+    } while (type != TokenType::EndOfFile);
+    return buffer;
+  }
+
+  // 次のトークンを1つ読み込む（末尾以降はEndOfFileを返し続ける）
+  Token next() {
+    Token token = read();
+    token.offset = static_cast<uint32_t>(m_start);
+    return token;
+  }
+
+private:
+  std::string_view m_source;
+  StringArena m_arena;
+  size_t m_position;
+  int m_line;
+  int m_column;
+  // 最後に読んだトークンの先頭位置
+  size_t m_start = 0;
+  // 空白とコメントを読み飛ばして次のトークンを読む
+  Token read() {
     // コードの末尾に来たら終了
     while (current() != '\0') {
       // 空白やコメントはスキップ
       if(skipWhitespace()) continue;
       if(skipComment()) continue;
-      // 始めの列数を記憶
+      // 始めの位置と列数を記憶
+      m_start = m_position;
       const int startColumn = m_column;
       // トークン化
-      if (std::isdigit(current())) tokens.push_back(readNumber());
-      else if (current() == '"') tokens.push_back(readString());
-      else if (std::isalpha(current()) || current() == '_') tokens.push_back(readIdentifier());
+      if (std::isdigit(current())) return readNumber();
+      else if (current() == '"') return readString();
+      else if (std::isalpha(current()) || current() == '_') return readIdentifier();
       else {
         TokenType type = TokenType::Unknown;
-        std::string value(1, current());
+        std::string_view value = m_source.substr(m_position, 1);
         switch (current()) {
           case '+': type = TokenType::Plus; break;
           case '-': type = TokenType::Minus; break;
@@ -152,7 +342,7 @@ public:
           case '=':
             if (peek() == '=') {
               type = TokenType::Equal;
-              value = "==";
+              value = m_source.substr(m_position, 2);
               advance();
             } else {
               type = TokenType::Assign;
@@ -161,14 +351,14 @@ public:
           case '!':
             if (peek() == '=') {
               type = TokenType::NotEqual;
-              value = "!=";
+              value = m_source.substr(m_position, 2);
               advance();
             }
             break;
           case '<':
             if (peek() == '=') {
               type = TokenType::LessEqual;
-              value = "<=";
+              value = m_source.substr(m_position, 2);
               advance();
             } else {
               type = TokenType::Less;
@@ -177,27 +367,22 @@ public:
           case '>':
             if (peek() == '=') {
               type = TokenType::GreaterEqual;
-              value = ">=";
+              value = m_source.substr(m_position, 2);
               advance();
             } else {
               type = TokenType::Greater;
             }
             break;
         }
-        tokens.push_back(Token{type, value, m_line, startColumn});
+        const Token token{type, value, m_line, startColumn};
         advance();
+        return token;
       }
     }
-    // ファイル末尾のトークンを追加
-    tokens.push_back(Token{TokenType::EndOfFile, "", m_line, m_column});
-    return tokens;
+    // ファイル末尾のトークン
+    m_start = m_position;
+    return Token{TokenType::EndOfFile, "", m_line, m_column};
   }
-
-private:
-  std::string m_source;
-  size_t m_position;
-  int m_line;
-  int m_column;
   // 現在の文字を取得
   char current() const {
     return m_position < m_source.length() ? m_source[m_position] : '\0';
@@ -217,73 +402,166 @@ private:
     }
     m_position++;
   }
-  // 空白文字をスキップ
+  // 空白文字をスキップ（改行数は一括で数えて行と列を更新）
   bool skipWhitespace() {
-    bool isWhitespace = false;
-    while (std::isspace(current())) {
-      isWhitespace = true;
-      advance();
+    const char* const begin = m_source.data() + m_position;
+    const size_t length = scan::whitespace(begin, m_source.data() + m_source.length());
+    if (length == 0) return false;
+    const scan::Newlines lines = scan::newlines(begin, length);
+    if (lines.count > 0) {
+      m_line += static_cast<int>(lines.count);
+      m_column = static_cast<int>(length - lines.last - 1);
+    } else {
+      m_column += static_cast<int>(length);
     }
-    return isWhitespace;
+    m_position += length;
+    return true;
   }
-  // コメント行をスキップ
+  // コメント行をスキップ（本文は改行を含まないので列だけ進める）
   bool skipComment() {
-    bool isComment = false;
-    if (current() == '/' && peek() == '/') {
-      while (!(current() == '\n' || current() == '\0')) {
-        isComment = true;
-        advance();
-      }
-    }
-    return isComment;
+    if (!(current() == '/' && peek() == '/')) return false;
+    const char* const begin = m_source.data() + m_position;
+    const size_t length = scan::untilLineEnd(begin, m_source.data() + m_source.length());
+    m_column += static_cast<int>(length);
+    m_position += length;
+    return true;
   }
   // 整数実数を読み込む
   Token readNumber() {
     const int startColumn = m_column;
-    std::string number;
+    const size_t start = m_position;
     bool isFloat = false;
     while (std::isdigit(current()) || current() == '.') {
       if (current() == '.') {
         if (isFloat) break;
         isFloat = true;
       }
-      number += current();
       advance();
     }
-    return Token{TokenType::Number, number, m_line, startColumn};
+    return Token{TokenType::Number, m_source.substr(start, m_position - start), m_line, startColumn};
   }
   // 文字列を読み込む
   Token readString() {
     const int startColumn = m_column;
-    std::string str;
     advance();
+    const size_t start = m_position;
+    bool hasEscape = false;
     while (!(current() == '"' || current() == '\0')) {
       if (current() == '\\') {
+        hasEscape = true;
         advance();
-        switch (current()) {
-          case 'n': str += '\n'; break;
-          case 't': str += '\t'; break;
-          case '\\': str += '\\'; break;
-          case '"': str += '"'; break;
-          default: str += current();
-        }
-      } else {
-        str += current();
+        if (current() == '\0') break;
       }
       advance();
     }
+    std::string_view str = m_source.substr(start, m_position - start);
+    // エスケープがある場合のみ展開してアリーナへ退避
+    if (hasEscape) str = unescape(str);
     if (current() == '"') advance();
     return Token{TokenType::String, str, m_line, startColumn};
   }
+  // エスケープシーケンスを展開
+  std::string_view unescape(const std::string_view raw) {
+    char* const begin = m_arena.allocate(raw.length());
+    char* out = begin;
+    for (size_t i = 0; i < raw.length(); ++i) {
+      if (raw[i] == '\\' && i + 1 < raw.length()) {
+        switch (raw[++i]) {
+          case 'n': *out++ = '\n'; break;
+          case 't': *out++ = '\t'; break;
+          case '\\': *out++ = '\\'; break;
+          case '"': *out++ = '"'; break;
+          default: *out++ = raw[i];
+        }
+      } else {
+        *out++ = raw[i];
+      }
+    }
+    return std::string_view(begin, out - begin);
+  }
   // 識別子を読み込む
   Token readIdentifier() {
     const int startColumn = m_column;
-    std::string id;
-    while(std::isalnum(current()) || current() == '_') {
-      id += current();
-      advance();
+    const size_t start = m_position;
+    const size_t length = scan::identifier(m_source.data() + start, m_source.data() + m_source.length());
+    m_column += static_cast<int>(length);
+    m_position += length;
+    const std::string_view id = m_source.substr(start, length);
+    const TokenType type = lookupKeyword(id);
+    Token token{type, id, m_line, startColumn};
+    if (type == TokenType::Identifier || type == TokenType::Tiu) {
+      token.symbol = symbolTable().intern(id);
     }
-    TokenType type = Id2TokenType.contains(id) ? Id2TokenType.at(id) : TokenType::Identifier;
-    return Token{type, id, m_line, startColumn};
+    return token;
+  }
+};
+
+// パーサーへ供給するトークン列（先読み分だけをリングバッファに保持する）
+class TokenStream {
+public:
+  // peek可能な先読み数（2の冪）
+  static constexpr size_t Lookahead = 4;
+  // ソースから逐次トークン化する
+  explicit TokenStream(std::string_view src)
+    : m_tokenizer(src), m_streaming(true), m_ring{pull(), pull(), pull(), pull()} {}
+  // ソースの途中から切り出した区間を逐次トークン化する
+  TokenStream(std::string_view src, const int line, const int column)
+    : m_tokenizer(src, line, column), m_streaming(true), m_ring{pull(), pull(), pull(), pull()} {}
+  // トークン化済みの列を読む
+  explicit TokenStream(std::vector<Token> tokens)
+    : m_tokenizer(""), m_tokens(std::move(tokens)), m_ring{pull(), pull(), pull(), pull()} {}
+  // TokenBufferの配列を直接読む（リングバッファは使わない）
+  explicit TokenStream(TokenBuffer buffer)
+    : m_tokenizer(""), m_buffer(std::move(buffer)), m_buffered(true), m_ring{pull(), pull(), pull(), pull()} {}
+  // offset個先のトークンの種別（先読みはLookahead - 1個まで）
+  TokenType type(const size_t offset = 0) const {
+    if (m_buffered) return m_buffer.type(std::min(m_position + std::min(offset, Lookahead - 1), m_buffer.size() - 1));
+    return m_ring[(m_head + std::min(offset, Lookahead - 1)) & (Lookahead - 1)].type;
+  }
+  SymbolId symbol() const {
+    return m_buffered ? m_buffer.symbol(m_position) : m_ring[m_head].symbol;
+  }
+  std::string_view value() const {
+    return m_buffered ? m_buffer.value(m_position) : m_ring[m_head].value;
+  }
+  int line() const {
+    return m_buffered ? m_buffer.line(m_position) : m_ring[m_head].line;
+  }
+  // 現在のトークンのソース上の先頭位置
+  size_t offset() const {
+    return m_buffered ? m_buffer.offset(m_position) : m_ring[m_head].offset;
+  }
+  Token current() const {
+    return m_buffered ? m_buffer.token(m_position) : m_ring[m_head];
+  }
+  // 末尾のEndOfFileでは止まる
+  void advance() {
+    if (type() == TokenType::EndOfFile) return;
+    if (!m_buffered) {
+      m_ring[m_head] = pull();
+      m_head = (m_head + 1) & (Lookahead - 1);
+    }
+    m_position++;
+  }
+  // 読み進めたトークン数
+  size_t position() const {
+    return m_position;
+  }
+private:
+  Tokenizer m_tokenizer;
+  std::vector<Token> m_tokens;
+  size_t m_next = 0;
+  bool m_streaming = false;
+  TokenBuffer m_buffer{""};
+  bool m_buffered = false;
+  std::array<Token, Lookahead> m_ring;
+  size_t m_head = 0;
+  size_t m_position = 0;
+  // 供給元から次のトークンを取り出す
+  Token pull() {
+    if (m_streaming) return m_tokenizer.next();
+    if (m_tokens.empty()) return Token{TokenType::EndOfFile, "", 1, 0};
+    if (m_next < m_tokens.size()) return m_tokens[m_next++];
+    return m_tokens.back();
   }
 };
\ No newline at end of file
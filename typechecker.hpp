@@ -0,0 +1,283 @@
+# pragma once
+# include <stdexcept>
+# include <unordered_map>
+# include <vector>
+
+# include "ast.hpp"
+
+// Resolver済みのASTの式に静的な型を付ける
+// entjeraからrealaへの変換や実行時の型検査が必要な箇所にはConvertNodeを挿入する
+class TypeChecker {
+public:
+  void check(ProgramNode& program) {
+    m_arena = program.arena.get();
+    m_types = program.types.get();
+    m_functions.push_back(FunctionScope{std::vector<const Type*>(program.frameSize, nullptr), {}, nullptr, nullptr});
+    for (ASTNode* stmt : program.statements) checkStatement(stmt);
+    m_functions.pop_back();
+  }
+private:
+  struct FunctionScope {
+    // スロットごとの宣言型と捕捉した変数の型
+    std::vector<const Type*> slotTypes;
+    std::vector<const Type*> captureTypes;
+    const Type* returnType;
+    // funkcioの自分自身の型
+    const Type* selfType;
+  };
+  AstArena* m_arena = nullptr;
+  TypeContext* m_types = nullptr;
+  std::vector<FunctionScope> m_functions;
+  // 宣言済みのklaso
+  std::unordered_map<const Type*, const ClassDeclNode*> m_classes;
+
+  static bool is(const Type* type, const TypeKind kind) {
+    return type && type->kind == kind;
+  }
+  static bool isNumber(const Type* type) {
+    return is(type, TypeKind::Entjera) || is(type, TypeKind::Reala);
+  }
+  static const Type* primitive(const TypeKind kind) {
+    return TypeContext::primitive(kind);
+  }
+  static std::string typeName(const Type* type) {
+    return type ? type->toString() : "unknown";
+  }
+  [[noreturn]] static void mismatch(const Type* source, const Type* target) {
+    throw std::runtime_error("Type mismatch: " + typeName(source) + " to " + typeName(target));
+  }
+
+  // 捕捉した変数の型は取り出し元の型を外側の関数で引く
+  void pushFunction(const uint32_t frameSize, const Type* paramType, const Type* returnType,
+                    const ArenaVector<Slot>& captures, const Type* selfType) {
+    std::vector<const Type*> captureTypes;
+    for (const Slot source : captures) captureTypes.push_back(slotType(source));
+    m_functions.push_back(FunctionScope{std::vector<const Type*>(frameSize, nullptr), std::move(captureTypes), returnType, selfType});
+    m_functions.back().slotTypes[0] = paramType;
+  }
+  const Type* slotType(const Slot slot) const {
+    switch (slot.storage) {
+      case Storage::Local: return m_functions.back().slotTypes[slot.index];
+      case Storage::Global: return m_functions.front().slotTypes[slot.index];
+      case Storage::Capture: return m_functions.back().captureTypes[slot.index];
+      case Storage::Self: return m_functions.back().selfType;
+    }
+    return nullptr;
+  }
+  void declareType(const Slot slot, const Type* type) {
+    FunctionScope& function = slot.storage == Storage::Global ? m_functions.front() : m_functions.back();
+    function.slotTypes[slot.index] = type;
+  }
+  // 式を型targetへ合わせる（必要ならConvertNodeで包む）
+  void convert(ExprNode*& expr, const Type* target) {
+    const Type* source = expr->type;
+    if (!target || source == target) return;
+    if (target->kind == TypeKind::Reala) {
+      if (!source || source->kind == TypeKind::Entjera) expr = m_arena->make<ConvertNode>(expr, target);
+      else if (source->kind != TypeKind::Reala) mismatch(source, target);
+      return;
+    }
+    // 型が分からない値は実行時に検査する
+    if (!source) {
+      expr = m_arena->make<ConvertNode>(expr, target);
+      return;
+    }
+    if (source->kind != target->kind) mismatch(source, target);
+    if (target->kind == TypeKind::Klaso && source != target) mismatch(source, target);
+    // シグネチャのないfunkciaにはどの関数も入る
+    if (target->kind == TypeKind::Funkcia && target->paramType && source->paramType) mismatch(source, target);
+  }
+  // klaso型の宣言
+  const ClassDeclNode* classOf(const Type* type) const {
+    if (type->kind != TypeKind::Klaso) throw std::runtime_error("Member access on non-klaso value");
+    const auto iter = m_classes.find(type);
+    if (iter == m_classes.end()) throw std::runtime_error("Unknown klaso " + type->toString());
+    return iter->second;
+  }
+  void requireClass(const Type* type) const {
+    if (type->kind == TypeKind::Klaso) classOf(type);
+  }
+  static std::string memberName(const SymbolId member) {
+    return std::string(symbolTable().name(member));
+  }
+  void condition(ExprNode*& expr) {
+    const Type* type = checkExpression(expr);
+    if (type && type->kind != TypeKind::Bulea) throw std::runtime_error("Condition must be bulea");
+  }
+  void checkBlock(ArenaVector<ASTNode*>& body) {
+    for (ASTNode* stmt : body) checkStatement(stmt);
+  }
+  void checkFunction(const uint32_t frameSize, const Type* paramType, const Type* returnType,
+                     const ArenaVector<Slot>& captures, const Type* selfType, ArenaVector<ASTNode*>& body) {
+    // 引数と戻り値の型もVarDeclと同じく宣言済みのklasoに限る
+    requireClass(paramType);
+    requireClass(returnType);
+    pushFunction(frameSize, paramType, returnType, captures, selfType);
+    checkBlock(body);
+    m_functions.pop_back();
+  }
+
+  void checkStatement(ASTNode* node) {
+    switch (node->kind) {
+      case NodeKind::VarDecl: {
+        auto* decl = static_cast<VarDeclNode*>(node);
+        requireClass(decl->type);
+        if (decl->initializer) {
+          checkExpression(decl->initializer);
+          convert(decl->initializer, decl->type);
+        }
+        declareType(decl->slot, decl->type);
+        break;
+      }
+      case NodeKind::Assign: {
+        auto* assign = static_cast<AssignNode*>(node);
+        checkExpression(assign->value);
+        convert(assign->value, slotType(assign->slot));
+        break;
+      }
+      case NodeKind::FunctionDecl: {
+        auto* func = static_cast<FunctionDeclNode*>(node);
+        // 再帰呼び出しで戻り値の型が分かるよう先に登録する
+        const Type* type = m_types->function(func->paramType, func->returnType);
+        declareType(func->slot, type);
+        checkFunction(func->frameSize, func->paramType, func->returnType, func->captures, type, func->body);
+        break;
+      }
+      case NodeKind::Return: {
+        auto* ret = static_cast<ReturnNode*>(node);
+        checkExpression(ret->value);
+        convert(ret->value, m_functions.back().returnType);
+        break;
+      }
+      case NodeKind::If: {
+        auto* ifNode = static_cast<IfNode*>(node);
+        condition(ifNode->condition);
+        checkBlock(ifNode->thenBody);
+        checkBlock(ifNode->elseBody);
+        break;
+      }
+      case NodeKind::While: {
+        auto* whileNode = static_cast<WhileNode*>(node);
+        condition(whileNode->condition);
+        checkBlock(whileNode->body);
+        break;
+      }
+      case NodeKind::Block:
+        checkBlock(static_cast<BlockNode*>(node)->body);
+        break;
+      case NodeKind::MemberAssign: {
+        auto* assign = static_cast<MemberAssignNode*>(node);
+        const Type* object = checkExpression(assign->object);
+        checkExpression(assign->value);
+        // 型が分からなければ実行時にフィールドの型へ合わせる
+        if (!object) break;
+        const ClassDeclNode* klass = classOf(object);
+        const int32_t index = klass->find(assign->member);
+        if (index < 0) throw std::runtime_error("Unknown member " + memberName(assign->member) + " of klaso " + object->toString());
+        if (static_cast<size_t>(index) >= klass->fields.size()) throw std::runtime_error("Cannot assign to method " + memberName(assign->member));
+        convert(assign->value, klass->fields[index]->type);
+        break;
+      }
+      case NodeKind::ClassDecl:
+        checkClass(static_cast<ClassDeclNode*>(node));
+        break;
+      default:
+        checkExpression(static_cast<ExprNode*>(node));
+    }
+  }
+
+  void checkClass(ClassDeclNode* node) {
+    // メソッドやフィールドの型から自分自身を参照できるよう先に登録する
+    if (!m_classes.emplace(node->type, node).second) throw std::runtime_error("Duplicate klaso " + node->type->toString());
+    for (VarDeclNode* field : node->fields) {
+      requireClass(field->type);
+      if (!field->initializer) continue;
+      checkExpression(field->initializer);
+      convert(field->initializer, field->type);
+    }
+    // メソッドはtiuだけをスロット0に持つ関数の内側
+    m_functions.push_back(FunctionScope{std::vector<const Type*>{node->type}, {}, nullptr, nullptr});
+    for (FunctionDeclNode* method : node->methods) {
+      checkFunction(method->frameSize, method->paramType, method->returnType, method->captures, nullptr, method->body);
+    }
+    m_functions.pop_back();
+  }
+
+  // 式の型を決めてnode->typeに設定する
+  const Type* checkExpression(ExprNode* node) {
+    node->type = typeOf(node);
+    return node->type;
+  }
+  const Type* typeOf(ExprNode* node) {
+    switch (node->kind) {
+      case NodeKind::NumberLiteral:
+        return primitive(static_cast<NumberLiteral*>(node)->isInteger ? TypeKind::Entjera : TypeKind::Reala);
+      case NodeKind::StringLiteral:
+        return primitive(TypeKind::Teksta);
+      case NodeKind::BoolLiteral:
+        return primitive(TypeKind::Bulea);
+      case NodeKind::VarRef:
+        return slotType(static_cast<VarRefNode*>(node)->slot);
+      case NodeKind::BinaryOp:
+        return checkBinary(static_cast<BinaryOpNode*>(node));
+      case NodeKind::Call: {
+        auto* call = static_cast<CallNode*>(node);
+        const Type* function = checkExpression(call->function);
+        checkExpression(call->argument);
+        if (function && function->kind != TypeKind::Funkcia) throw std::runtime_error("Called value is not a funkcia");
+        // シグネチャが分かる呼び出しは引数を合わせて戻り値の型を使う
+        if (!function || !function->paramType) return nullptr;
+        convert(call->argument, function->paramType);
+        return function->returnType;
+      }
+      case NodeKind::AtFunction: {
+        auto* atFunc = static_cast<AtFunctionNode*>(node);
+        const Type* type = m_types->function(atFunc->paramType, atFunc->returnType);
+        checkFunction(atFunc->frameSize, atFunc->paramType, atFunc->returnType, atFunc->captures, nullptr, atFunc->body);
+        return type;
+      }
+      case NodeKind::MemberAccess: {
+        auto* member = static_cast<MemberAccessNode*>(node);
+        const Type* object = checkExpression(member->object);
+        if (!object) return nullptr;
+        const ClassDeclNode* klass = classOf(object);
+        const int32_t index = klass->find(member->member);
+        if (index < 0) throw std::runtime_error("Unknown member " + memberName(member->member) + " of klaso " + object->toString());
+        if (static_cast<size_t>(index) < klass->fields.size()) return klass->fields[index]->type;
+        const FunctionDeclNode* method = klass->methods[index - klass->fields.size()];
+        return m_types->function(method->paramType, method->returnType);
+      }
+      case NodeKind::Convert:
+        return node->type;
+      default:
+        throw std::runtime_error("Unknown expression");
+    }
+  }
+  const Type* checkBinary(BinaryOpNode* node) {
+    using OpType = BinaryOpNode::OpType;
+    const Type* left = checkExpression(node->left);
+    const Type* right = checkExpression(node->right);
+    const bool comparison = node->op >= OpType::Eq;
+    const bool equality = node->op == OpType::Eq || node->op == OpType::NEq;
+    const Type* boolean = primitive(TypeKind::Bulea);
+    // 整数同士
+    if (is(left, TypeKind::Entjera) && is(right, TypeKind::Entjera)) {
+      return comparison ? boolean : left;
+    }
+    // 片方が実数なら整数側を変換して実数で計算する
+    if (isNumber(left) && isNumber(right)) {
+      const Type* real = primitive(TypeKind::Reala);
+      convert(node->left, real);
+      convert(node->right, real);
+      return comparison ? boolean : real;
+    }
+    if (is(left, TypeKind::Teksta) && is(right, TypeKind::Teksta)) {
+      if (node->op == OpType::Add) return left;
+      if (equality) return boolean;
+    }
+    if (is(left, TypeKind::Bulea) && is(right, TypeKind::Bulea) && equality) return boolean;
+    // どちらかの型が分からなければ実行時に判定する
+    if (left && right) throw std::runtime_error("Type mismatch in binary operation");
+    return comparison ? boolean : nullptr;
+  }
+};
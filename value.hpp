@@ -0,0 +1,655 @@
+# pragma once
+# include <algorithm>
+# include <cstdint>
+# include <cstring>
+# include <initializer_list>
+# include <limits>
+# include <memory>
+# include <new>
+# include <span>
+# include <string>
+# include <string_view>
+# include <type_traits>
+# include <vector>
+# include <format>
+# include <stdexcept>
+
+# include "ast.hpp"
+
+struct FunctionProto;
+struct Closure;
+struct Instance;
+struct Box;
+
+// 実行時の値の種類（イメージの定数はこの番号で書く）
+enum class ValueKind : uint8_t { Nil, Int, Real, Bool, String, Closure, Instance, Box };
+
+// GCが管理するヒープ上のオブジェクトの先頭
+struct HeapObject {
+  // GCの状態
+  static constexpr uint8_t Marked = 1;
+  static constexpr uint8_t Remembered = 2;
+  static constexpr uint8_t Forwarded = 4;
+  ValueKind kind;
+  uint8_t flags = 0;
+};
+
+// 長いtekstaの本体（文字列はオブジェクトの直後に並べる）
+struct StringObject : HeapObject {
+  uint32_t size;
+  char* chars() {
+    return reinterpret_cast<char*>(this + 1);
+  }
+};
+
+// 実行時の値（entjera, reala, bulea, teksta, funkcia, klaso と、共有される変数の箱）
+// 16バイトに収め、数値・真偽値・SmallCapacityバイトまでの文字列は値の中に直接持つ
+// 長い文字列・クロージャ・インスタンス・箱だけHeapのオブジェクトを指す（コピーは16バイトのコピーだけ）
+class Value {
+public:
+  static constexpr size_t SmallCapacity = 14;
+
+  Value() {
+    m_bits.tag = Tag::Nil;
+  }
+  Value(const int64_t value) {
+    m_bits.integer = value;
+    m_bits.tag = Tag::Int;
+  }
+  Value(const double value) {
+    m_bits.real = value;
+    m_bits.tag = Tag::Real;
+  }
+  Value(const bool value) {
+    m_bits.boolean = value;
+    m_bits.tag = Tag::Bool;
+  }
+  Value(const std::string_view text) {
+    append(allocateString(text.size()), text);
+  }
+  Value(const std::string& text)
+    : Value(std::string_view(text)) {}
+  // 文字列リテラルがboolへ変換されないようにする
+  Value(const char* text)
+    : Value(std::string_view(text)) {}
+  // ヒープのオブジェクトを指す値
+  static Value adopt(HeapObject* object) {
+    Value value;
+    value.m_bits.tag = static_cast<Tag>(static_cast<uint8_t>(object->kind) + 1);
+    value.m_bits.object = object;
+    return value;
+  }
+  // GCで回収も移動もしない文字列（コンパイル済みの定数用）
+  static Value permanent(std::string_view text);
+  static Value concat(const std::string_view left, const std::string_view right) {
+    Value value;
+    append(append(value.allocateString(left.size() + right.size()), left), right);
+    return value;
+  }
+
+  ValueKind kind() const {
+    return m_bits.tag == Tag::SmallString ? ValueKind::String : static_cast<ValueKind>(static_cast<uint8_t>(m_bits.tag) - (m_bits.tag > Tag::SmallString));
+  }
+  bool isNil() const { return m_bits.tag == Tag::Nil; }
+  bool isInt() const { return m_bits.tag == Tag::Int; }
+  bool isReal() const { return m_bits.tag == Tag::Real; }
+  bool isBool() const { return m_bits.tag == Tag::Bool; }
+  bool isString() const { return m_bits.tag == Tag::SmallString || m_bits.tag == Tag::String; }
+  bool isClosure() const { return m_bits.tag == Tag::Closure; }
+  bool isInstance() const { return m_bits.tag == Tag::Instance; }
+  bool isBox() const { return m_bits.tag == Tag::Box; }
+
+  // 種類を確かめずに中身を読む（種類は呼び出し側が保証する）
+  int64_t asInt() const { return m_bits.integer; }
+  double asReal() const { return m_bits.real; }
+  bool asBool() const { return m_bits.boolean; }
+  std::string_view asString() const {
+    if (m_bits.tag == Tag::SmallString) return std::string_view(smallChars(), m_bits.length);
+    auto* const string = static_cast<StringObject*>(object());
+    return std::string_view(string->chars(), string->size);
+  }
+  Closure& asClosure() const { return *reinterpret_cast<Closure*>(object()); }
+  Instance& asInstance() const { return *reinterpret_cast<Instance*>(object()); }
+  Box& asBox() const { return *reinterpret_cast<Box*>(object()); }
+  // 指しているヒープのオブジェクト（なければnullptr）
+  HeapObject* heapObject() const {
+    return onHeap(m_bits) ? m_bits.object : nullptr;
+  }
+private:
+  friend class Heap;
+  // ValueKindの順に短い文字列を挟み、ヒープのオブジェクトを指すものを最後に並べる
+  enum class Tag : uint8_t { Nil, Int, Real, Bool, SmallString, String, Closure, Instance, Box };
+  // 数値・真偽値・ポインタは先頭8バイトに置く
+  // 短い文字列は先頭からrestまでのSmallCapacityバイトに置く
+  // （コピーは構造体ごと行い、型の分かる8バイト2つの移動にする）
+  struct Bits {
+    union {
+      int64_t integer;
+      double real;
+      bool boolean;
+      HeapObject* object;
+    };
+    char rest[SmallCapacity - sizeof(int64_t)];
+    uint8_t length;
+    Tag tag;
+  };
+  Bits m_bits;
+
+  HeapObject* object() const {
+    return m_bits.object;
+  }
+  char* smallChars() {
+    return reinterpret_cast<char*>(this);
+  }
+  const char* smallChars() const {
+    return reinterpret_cast<const char*>(this);
+  }
+  static bool onHeap(const Bits& bits) {
+    return bits.tag >= Tag::String;
+  }
+  // 空のstring_viewはdataがnullptrのことがあるので長さ0ならコピーしない
+  static char* append(char* const out, const std::string_view text) {
+    if (!text.empty()) std::memcpy(out, text.data(), text.size());
+    return out + text.size();
+  }
+  // 文字列を書き込む領域を用意する（短ければ値の中、長ければヒープ）
+  char* allocateString(size_t size, bool permanent = false);
+};
+static_assert(sizeof(Value) == 16 && std::is_trivially_copyable_v<Value>);
+
+// クロージャ（関数本体と捕捉した変数）
+// 捕捉した変数はオブジェクトの直後に並べて1回の確保で持つ
+struct Closure : HeapObject {
+  // FunctionDeclNodeかAtFunctionNode（Interpreter用）
+  const ASTNode* function;
+  // コンパイル済みの関数（VM用）
+  const FunctionProto* proto;
+  uint32_t captureCount;
+  static Value make(const ASTNode* function, const FunctionProto* proto, uint32_t captureCount);
+  Value* captures() {
+    return reinterpret_cast<Value*>(this + 1);
+  }
+};
+
+// klasoの実行時の情報（インスタンスはこれを指すので実行結果より長く保つ）
+// VMは宣言を見ずにこれだけで動くので、バイトコードのイメージから読み込んだklasoはdeclを持たない
+struct ClassInfo {
+  // 宣言（Interpreterとコンパイラ用、イメージから読み込んだ場合はnullptr）
+  const ClassDeclNode* decl;
+  SymbolId className;
+  const Type* type;
+  uint32_t fieldCount;
+  // フィールドとメソッドの名前（この順にメンバーの番号を振る）
+  std::vector<SymbolId> members;
+  // フィールドの宣言された型
+  std::vector<const Type*> fieldTypes;
+  // メソッドのコンパイル済みの関数の番号（VM用、decl->methodsと同じ順）
+  std::vector<uint32_t> methods;
+  explicit ClassInfo(const ClassDeclNode* d)
+    : decl(d), className(d->name), type(d->type), fieldCount(static_cast<uint32_t>(d->fields.size())) {
+    for (const VarDeclNode* field : d->fields) {
+      members.push_back(field->name);
+      fieldTypes.push_back(field->type);
+    }
+    for (const FunctionDeclNode* method : d->methods) members.push_back(method->name);
+  }
+  ClassInfo(const SymbolId name, const Type* t, std::vector<SymbolId> memberNames, std::vector<const Type*> types, std::vector<uint32_t> methodIndices)
+    : decl(nullptr), className(name), type(t), fieldCount(static_cast<uint32_t>(types.size())),
+      members(std::move(memberNames)), fieldTypes(std::move(types)), methods(std::move(methodIndices)) {}
+  std::string_view name() const {
+    return symbolTable().name(className);
+  }
+  // メンバーの番号（フィールドが先、見つからなければ-1）
+  int32_t find(const SymbolId member) const {
+    for (size_t i = 0; i < members.size(); ++i) {
+      if (members[i] == member) return static_cast<int32_t>(i);
+    }
+    return -1;
+  }
+};
+
+// klasoのインスタンス
+// フィールドはClassDeclNode::fieldsの順にオブジェクトの直後に並べて1回の確保で持つ
+struct Instance : HeapObject {
+  const ClassInfo* klass;
+  uint32_t fieldCount;
+  static Value make(const ClassInfo* klass);
+  Value* fields() {
+    return reinterpret_cast<Value*>(this + 1);
+  }
+};
+
+// 捕捉されたうえで代入される変数の箱
+struct Box : HeapObject {
+  Value value;
+};
+
+static_assert(sizeof(Closure) % alignof(Value) == 0 && sizeof(Instance) % alignof(Value) == 0);
+
+// 実行時のオブジェクトのヒープ（世代別のGC）
+// 新しいオブジェクトはナーサリへバンプ確保し、マイナーGCで生きているものを旧世代へコピーする
+// 旧世代はオブジェクトごとに確保し、増えたらマーク・スイープで回収する
+// 旧世代から若いオブジェクトへの参照は書き込みバリア（storeField・storeBoxed）で記憶集合に入れる
+// 確保の途中ではGCせず、実行側が全ての値をルートとして渡せる安全点でcollectを呼ぶ
+// （オブジェクトが移動するので、安全点をまたいでオブジェクトへのポインタを持たない）
+class Heap {
+public:
+  static constexpr size_t NurserySize = 1 << 20;
+  // これより大きいオブジェクトは旧世代へ直接確保する
+  static constexpr size_t LargeObject = NurserySize / 16;
+  static constexpr size_t InitialOldLimit = 16 << 20;
+  struct Stats {
+    size_t minor = 0;
+    size_t major = 0;
+    // 旧世代へコピーしたバイト数とメジャーGCで解放したバイト数
+    size_t promoted = 0;
+    size_t freed = 0;
+  };
+
+  Heap()
+    : m_nursery(static_cast<char*>(::operator new(NurserySize))), m_top(m_nursery), m_end(m_nursery + NurserySize),
+      m_trigger(m_nursery + NurserySize / 8 * 7) {}
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+  ~Heap() {
+    for (HeapObject* object : m_old) ::operator delete(object);
+    for (void* memory : m_permanent) ::operator delete(memory);
+    ::operator delete(m_nursery);
+  }
+
+  void* allocate(size_t size) {
+    size = align(size);
+    if (size <= LargeObject && size <= static_cast<size_t>(m_end - m_top)) {
+      void* const memory = m_top;
+      m_top += size;
+      return memory;
+    }
+    return allocateOld(size);
+  }
+  void* allocatePermanent(const size_t size) {
+    return m_permanent.emplace_back(::operator new(size));
+  }
+  bool young(const HeapObject* object) const {
+    return reinterpret_cast<uintptr_t>(object) - reinterpret_cast<uintptr_t>(m_nursery) < NurserySize;
+  }
+  // ナーサリがほぼ埋まったか旧世代が上限を超えた
+  bool collectRequested() const {
+    return m_top > m_trigger || m_oldBytes > m_oldLimit;
+  }
+  // 旧世代のオブジェクトが若いオブジェクトを指すようになった
+  void remember(HeapObject* owner) {
+    if (owner->flags & HeapObject::Remembered) return;
+    owner->flags |= HeapObject::Remembered;
+    m_remembered.push_back(owner);
+  }
+  // rootsの値から辿れないオブジェクトを回収し、移動したオブジェクトを指す値を書き換える
+  void collect(const std::span<const std::span<Value>> roots) {
+    minor(roots);
+    if (m_oldBytes > m_oldLimit) major(roots);
+  }
+  void collect(const std::initializer_list<std::span<Value>> roots) {
+    collect(std::span(roots.begin(), roots.size()));
+  }
+  const Stats& stats() const {
+    return m_stats;
+  }
+  // これまでに確保したバイト数（ナーサリの分は使った範囲から求める）
+  size_t allocated() const {
+    return m_allocated + static_cast<size_t>(m_top - m_nursery);
+  }
+private:
+  char* m_nursery;
+  char* m_top;
+  char* m_end;
+  char* m_trigger;
+  std::vector<HeapObject*> m_old;
+  size_t m_oldBytes = 0;
+  size_t m_oldLimit = InitialOldLimit;
+  std::vector<HeapObject*> m_remembered;
+  // 子を辿っていないオブジェクト
+  std::vector<HeapObject*> m_pending;
+  std::vector<void*> m_permanent;
+  Stats m_stats;
+  // 空にしたナーサリと旧世代へ直接確保した分
+  size_t m_allocated = 0;
+
+  static size_t align(const size_t size) {
+    return (size + alignof(Value) - 1) & ~(alignof(Value) - 1);
+  }
+  // ナーサリに入らなかったオブジェクト
+  // 作った直後のフィールドの初期化はバリアを通らないので、最初から記憶集合に入れておく
+  void* allocateOld(const size_t size) {
+    auto* const object = static_cast<HeapObject*>(::operator new(size));
+    m_old.push_back(object);
+    m_oldBytes += size;
+    m_allocated += size;
+    m_remembered.push_back(object);
+    return object;
+  }
+  static size_t sizeOf(HeapObject* object);
+  // コピー済みのオブジェクトの転送先を書く位置（ヘッダの後の最初の8バイト、長い文字列も8バイト以上ある）
+  static void* forwarding(HeapObject* object) {
+    return reinterpret_cast<char*>(object) + alignof(Value);
+  }
+  template<class F>
+  static void forEachChild(HeapObject* object, F&& f);
+
+  // 若いオブジェクトを指していれば旧世代へコピーして指し直す（コピー済みなら転送先を読む）
+  void evacuate(Value& value) {
+    HeapObject* const object = value.heapObject();
+    if (!object || !young(object)) return;
+    HeapObject* copy;
+    if (object->flags & HeapObject::Forwarded) {
+      std::memcpy(&copy, forwarding(object), sizeof(copy));
+    } else {
+      const size_t size = sizeOf(object);
+      copy = static_cast<HeapObject*>(::operator new(size));
+      std::memcpy(static_cast<void*>(copy), object, size);
+      copy->flags = 0;
+      m_old.push_back(copy);
+      m_oldBytes += size;
+      m_stats.promoted += size;
+      m_pending.push_back(copy);
+      object->flags |= HeapObject::Forwarded;
+      std::memcpy(forwarding(object), &copy, sizeof(copy));
+    }
+    value.m_bits.object = copy;
+  }
+  void minor(const std::span<const std::span<Value>> roots) {
+    for (const std::span<Value> values : roots) {
+      for (Value& value : values) evacuate(value);
+    }
+    for (HeapObject* owner : m_remembered) {
+      owner->flags &= ~HeapObject::Remembered;
+      forEachChild(owner, [this](Value& value) { evacuate(value); });
+    }
+    m_remembered.clear();
+    while (!m_pending.empty()) {
+      HeapObject* const object = m_pending.back();
+      m_pending.pop_back();
+      forEachChild(object, [this](Value& value) { evacuate(value); });
+    }
+    m_allocated += static_cast<size_t>(m_top - m_nursery);
+    m_top = m_nursery;
+    ++m_stats.minor;
+  }
+  void mark(Value& value) {
+    HeapObject* const object = value.heapObject();
+    if (!object || (object->flags & HeapObject::Marked)) return;
+    object->flags |= HeapObject::Marked;
+    m_pending.push_back(object);
+  }
+  // マイナーGCの直後に行うのでナーサリは空
+  // 永続の文字列にも印が付くが、子を持たず回収もしないので外さなくてよい
+  void major(const std::span<const std::span<Value>> roots) {
+    for (const std::span<Value> values : roots) {
+      for (Value& value : values) mark(value);
+    }
+    while (!m_pending.empty()) {
+      HeapObject* const object = m_pending.back();
+      m_pending.pop_back();
+      forEachChild(object, [this](Value& value) { mark(value); });
+    }
+    std::erase_if(m_old, [this](HeapObject* object) {
+      if (object->flags & HeapObject::Marked) {
+        object->flags &= ~HeapObject::Marked;
+        return false;
+      }
+      const size_t size = sizeOf(object);
+      m_oldBytes -= size;
+      m_stats.freed += size;
+      ::operator delete(object);
+      return true;
+    });
+    m_oldLimit = std::max(InitialOldLimit, m_oldBytes * 2);
+    ++m_stats.major;
+  }
+};
+
+inline Heap& heap() {
+  static Heap instance;
+  return instance;
+}
+
+inline size_t Heap::sizeOf(HeapObject* object) {
+  switch (object->kind) {
+    case ValueKind::String: return align(sizeof(StringObject) + static_cast<StringObject*>(object)->size);
+    case ValueKind::Closure: return sizeof(Closure) + sizeof(Value) * static_cast<Closure*>(object)->captureCount;
+    case ValueKind::Instance: return sizeof(Instance) + sizeof(Value) * static_cast<Instance*>(object)->fieldCount;
+    default: return sizeof(Box);
+  }
+}
+template<class F>
+void Heap::forEachChild(HeapObject* object, F&& f) {
+  switch (object->kind) {
+    case ValueKind::Closure: {
+      auto* const closure = static_cast<Closure*>(object);
+      for (uint32_t i = 0; i < closure->captureCount; ++i) f(closure->captures()[i]);
+      break;
+    }
+    case ValueKind::Instance: {
+      auto* const instance = static_cast<Instance*>(object);
+      for (uint32_t i = 0; i < instance->fieldCount; ++i) f(instance->fields()[i]);
+      break;
+    }
+    case ValueKind::Box: f(static_cast<Box*>(object)->value); break;
+    default: break;
+  }
+}
+
+inline char* Value::allocateString(const size_t size, const bool permanent) {
+  if (size <= SmallCapacity) {
+    m_bits.tag = Tag::SmallString;
+    m_bits.length = static_cast<uint8_t>(size);
+    return smallChars();
+  }
+  if (size > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("teksta is too long");
+  const size_t bytes = sizeof(StringObject) + size;
+  void* const memory = permanent ? heap().allocatePermanent(bytes) : heap().allocate(bytes);
+  auto* const string = new (memory) StringObject{{ValueKind::String}, static_cast<uint32_t>(size)};
+  m_bits.tag = Tag::String;
+  m_bits.object = string;
+  return string->chars();
+}
+inline Value Value::permanent(const std::string_view text) {
+  Value value;
+  append(value.allocateString(text.size(), true), text);
+  return value;
+}
+
+inline Value Closure::make(const ASTNode* function, const FunctionProto* proto, const uint32_t captureCount) {
+  void* const memory = heap().allocate(sizeof(Closure) + sizeof(Value) * captureCount);
+  Closure* const closure = new (memory) Closure{{ValueKind::Closure}, function, proto, captureCount};
+  std::uninitialized_default_construct_n(closure->captures(), captureCount);
+  return Value::adopt(closure);
+}
+
+inline Value Instance::make(const ClassInfo* klass) {
+  void* const memory = heap().allocate(sizeof(Instance) + sizeof(Value) * klass->fieldCount);
+  Instance* const instance = new (memory) Instance{{ValueKind::Instance}, klass, klass->fieldCount};
+  std::uninitialized_default_construct_n(instance->fields(), klass->fieldCount);
+  return Value::adopt(instance);
+}
+
+// 既にあるオブジェクトへの書き込み（旧世代から若いオブジェクトを指すようになれば記憶する）
+inline void writeBarrier(HeapObject& owner, const Value& value) {
+  const HeapObject* const object = value.heapObject();
+  if (object && heap().young(object) && !heap().young(&owner)) heap().remember(&owner);
+}
+inline void storeField(Instance& instance, const uint32_t index, const Value& value) {
+  writeBarrier(instance, value);
+  instance.fields()[index] = value;
+}
+
+// メンバーアクセスの対象のインスタンス
+inline Instance& instanceOf(Value& value) {
+  if (!value.isInstance()) throw std::runtime_error("Member access on non-klaso value");
+  return value.asInstance();
+}
+[[noreturn]] inline void unknownMember(const ClassInfo& klass, const SymbolId member) {
+  throw std::runtime_error("Unknown member " + std::string(symbolTable().name(member)) + " of klaso " + std::string(klass.name()));
+}
+// メソッドをインスタンスに束縛したクロージャ（メソッドが捕捉できるのはtiuだけ）
+inline Value bindMethod(const ASTNode* method, const FunctionProto* proto, const uint32_t captureCount, const Value& instance) {
+  Value closure = Closure::make(method, proto, captureCount);
+  std::fill_n(closure.asClosure().captures(), captureCount, instance);
+  return closure;
+}
+
+// 箱の中身（箱に入れた変数の読み書き用）
+inline const Value& unbox(const Value& value) {
+  return value.asBox().value;
+}
+inline void storeBoxed(const Value& box, const Value& value) {
+  writeBarrier(box.asBox(), value);
+  box.asBox().value = value;
+}
+inline Value box(const Value& value) {
+  return Value::adopt(new (heap().allocate(sizeof(Box))) Box{{ValueKind::Box}, value});
+}
+
+// トップレベルの変数の領域
+struct Frame {
+  std::vector<Value> slots;
+  explicit Frame(const uint32_t size)
+    : slots(size) {}
+};
+
+// 関数呼び出しの深さの上限（VMとInterpreterで共通）
+constexpr size_t MaxCallDepth = 1 << 16;
+
+// 整数の四則演算（Interpreter・VM・Optimizerで共有）
+// オーバーフローは2の補数で折り返し（INT64_MIN / -1もINT64_MINになる）、エラーになるのは0除算だけ
+inline int64_t addInt(const int64_t l, const int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) + static_cast<uint64_t>(r));
+}
+inline int64_t subInt(const int64_t l, const int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) - static_cast<uint64_t>(r));
+}
+inline int64_t mulInt(const int64_t l, const int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) * static_cast<uint64_t>(r));
+}
+inline int64_t divInt(const int64_t l, const int64_t r) {
+  if (r == 0) throw std::runtime_error("Division by zero");
+  if (r == -1) return static_cast<int64_t>(0 - static_cast<uint64_t>(l));
+  return l / r;
+}
+
+// 静的な型が分からない二項演算（Interpreterと汎用命令で共有）
+inline Value binaryOp(const BinaryOpNode::OpType op, const Value& left, const Value& right) {
+  using OpType = BinaryOpNode::OpType;
+  // 整数同士
+  if (left.isInt() && right.isInt()) {
+    const int64_t l = left.asInt();
+    const int64_t r = right.asInt();
+    switch (op) {
+      case OpType::Add: return addInt(l, r);
+      case OpType::Sub: return subInt(l, r);
+      case OpType::Mul: return mulInt(l, r);
+      case OpType::Div: return divInt(l, r);
+      case OpType::Eq: return l == r;
+      case OpType::NEq: return l != r;
+      case OpType::LT: return l < r;
+      case OpType::GT: return l > r;
+      case OpType::LE: return l <= r;
+      case OpType::GE: return l >= r;
+    }
+  }
+  // 整数と実数の混在は実数で計算する
+  const auto asReal = [](const Value& v, double& out) {
+    if (v.isInt()) { out = static_cast<double>(v.asInt()); return true; }
+    if (v.isReal()) { out = v.asReal(); return true; }
+    return false;
+  };
+  double l, r;
+  if (asReal(left, l) && asReal(right, r)) {
+    switch (op) {
+      case OpType::Add: return l + r;
+      case OpType::Sub: return l - r;
+      case OpType::Mul: return l * r;
+      case OpType::Div: return l / r;
+      case OpType::Eq: return l == r;
+      case OpType::NEq: return l != r;
+      case OpType::LT: return l < r;
+      case OpType::GT: return l > r;
+      case OpType::LE: return l <= r;
+      case OpType::GE: return l >= r;
+    }
+  }
+  // 文字列の連結と比較
+  if (left.isString() && right.isString()) {
+    const std::string_view l = left.asString();
+    const std::string_view r = right.asString();
+    switch (op) {
+      case OpType::Add: return Value::concat(l, r);
+      case OpType::Eq: return l == r;
+      case OpType::NEq: return l != r;
+      default: break;
+    }
+  }
+  // 真偽値の比較
+  if (left.isBool() && right.isBool()) {
+    if (op == OpType::Eq) return left.asBool() == right.asBool();
+    if (op == OpType::NEq) return left.asBool() != right.asBool();
+  }
+  throw std::runtime_error("Type mismatch in binary operation");
+}
+
+// 静的な型が分からなかった値の実行時検査
+[[noreturn]] inline void typeError(const char* expected) {
+  throw std::runtime_error(std::string("Type mismatch: expected ") + expected);
+}
+inline void checkType(const Value& value, const TypeKind kind) {
+  switch (kind) {
+    case TypeKind::Entjera: if (!value.isInt()) typeError("entjera"); break;
+    case TypeKind::Reala: if (!value.isReal()) typeError("reala"); break;
+    case TypeKind::Teksta: if (!value.isString()) typeError("teksta"); break;
+    case TypeKind::Bulea: if (!value.isBool()) typeError("bulea"); break;
+    case TypeKind::Funkcia: if (!value.isClosure()) typeError("funkcia"); break;
+    case TypeKind::Klaso: if (!value.isInstance()) typeError("klaso"); break;
+    default: break;
+  }
+}
+// realaへ合わせる（entjeraは変換する）
+inline void coerceReal(Value& value) {
+  if (value.isInt()) value = static_cast<double>(value.asInt());
+  else if (!value.isReal()) typeError("reala");
+}
+// 宣言された型へ合わせる
+inline void coerce(Value& value, const TypeKind kind) {
+  if (kind == TypeKind::Reala) coerceReal(value);
+  else checkType(value, kind);
+}
+// klasoはクラスまで検査する
+inline void checkClass(const Value& value, const Type* type) {
+  if (!value.isInstance() || value.asInstance().klass->type != type) typeError(std::string(type->className).c_str());
+}
+inline void coerce(Value& value, const Type* type) {
+  if (type->kind == TypeKind::Klaso) checkClass(value, type);
+  else coerce(value, type->kind);
+}
+
+template<>
+struct std::formatter<Value> {
+  constexpr auto parse(std::format_parse_context& ctx) {
+    return ctx.begin();
+  }
+  auto format(const Value& value, std::format_context& ctx) const {
+    switch (value.kind()) {
+      case ValueKind::Int: return std::format_to(ctx.out(), "{}", value.asInt());
+      case ValueKind::Real: {
+        // 整数と区別できるよう小数点を必ず付ける
+        const std::string real = std::format("{}", value.asReal());
+        const bool plain = real.find_first_of(".einf") == std::string::npos;
+        return std::format_to(ctx.out(), "{}{}", real, plain ? ".0" : "");
+      }
+      case ValueKind::Bool: return std::format_to(ctx.out(), "{}", value.asBool() ? "vero" : "malvero");
+      case ValueKind::String: return std::format_to(ctx.out(), "\"{}\"", value.asString());
+      case ValueKind::Closure: return std::format_to(ctx.out(), "<funkcia>");
+      case ValueKind::Instance: return std::format_to(ctx.out(), "<{}>", value.asInstance().klass->name());
+      case ValueKind::Nil:
+      case ValueKind::Box: break;
+    }
+    return std::format_to(ctx.out(), "void");
+  }
+};
@@ -0,0 +1,459 @@
+# pragma once
+# include <algorithm>
+# include <format>
+# include <memory>
+# include <stdexcept>
+# include <string>
+# include <vector>
+
+# include "bytecode.hpp"
+
+// GCC/Clangでは命令ごとに間接ジャンプするcomputed gotoで分岐する
+# if defined(__GNUC__)
+#   define ESPERO_COMPUTED_GOTO 1
+# else
+#   define ESPERO_COMPUTED_GOTO 0
+# endif
+
+// --profileで数える実行回数
+// callsは関数の番号ごとの呼び出し回数（末尾呼び出しを含む）、loopsは関数ごと・命令番号ごとの後方ジャンプ先へ戻った回数
+struct VMProfile {
+  std::vector<uint64_t> calls;
+  std::vector<std::vector<uint64_t>> loops;
+
+  // 呼び出し回数の多い関数と周回数の多いループをそれぞれlimit個まで
+  std::string report(const BytecodeModule& module, const size_t limit = 10) const {
+    const auto functionName = [&module](const size_t f) {
+      const FunctionProto& proto = module.functions[f];
+      return f == 0 ? std::string("<toplevel>") : std::format("#{} {}", f, proto.hasName ? symbolTable().name(proto.name) : "<anonymous>");
+    };
+    std::vector<std::pair<uint64_t, size_t>> functions;
+    for (size_t f = 0; f < calls.size(); ++f) {
+      if (calls[f] > 0) functions.emplace_back(calls[f], f);
+    }
+    std::vector<std::pair<uint64_t, std::pair<size_t, size_t>>> backEdges;
+    for (size_t f = 0; f < loops.size(); ++f) {
+      for (size_t target = 0; target < loops[f].size(); ++target) {
+        if (loops[f][target] > 0) backEdges.push_back({loops[f][target], {f, target}});
+      }
+    }
+    // 回数の多い順（同じなら番号順）
+    const auto byCount = [](const auto& l, const auto& r) { return l.first != r.first ? l.first > r.first : l.second < r.second; };
+    std::sort(functions.begin(), functions.end(), byCount);
+    std::sort(backEdges.begin(), backEdges.end(), byCount);
+    std::string out = "calls:\n";
+    for (size_t i = 0; i < std::min(limit, functions.size()); ++i) {
+      std::format_to(std::back_inserter(out), "  {:>12}  {}\n", functions[i].first, functionName(functions[i].second));
+    }
+    out += "loops:\n";
+    for (size_t i = 0; i < std::min(limit, backEdges.size()); ++i) {
+      const auto [f, target] = backEdges[i].second;
+      std::format_to(std::back_inserter(out), "  {:>12}  {} @{:04}\n", backEdges[i].first, functionName(f), target);
+    }
+    return out;
+  }
+};
+
+// バイトコードを実行するスタックVM
+// ローカル変数は値スタック上の窓に置き、その直前に呼び出し中のクロージャを置く
+// メンバーアクセスは箇所ごとのインラインキャッシュでklasoからメンバーの番号を引く
+class VM {
+public:
+  explicit VM(const BytecodeModule& module)
+    : m_module(module), m_heap(heap()), m_stack(InitialStackSize), m_caches(module.memberSites.size()) {
+    for (const FunctionProto& proto : module.functions) m_frameBound = std::max<size_t>(m_frameBound, proto.frameSize + proto.maxStack);
+    // 静的に型が分かった箇所は最初から当たる
+    for (size_t i = 0; i < m_caches.size(); ++i) {
+      const MemberSite& site = module.memberSites[i];
+      if (site.klass < 0) continue;
+      m_caches[i].klass[0] = &module.classes[site.klass];
+      m_caches[i].index[0] = site.index;
+    }
+  }
+  // 実行回数をprofileに数える（数えない実行とは別にコンパイルしたループで回すので、普段の実行は遅くならない）
+  void setProfile(VMProfile* const profile) {
+    m_profile = profile;
+    if (!profile) return;
+    profile->calls.assign(m_module.functions.size(), 0);
+    profile->loops.resize(m_module.functions.size());
+    for (size_t f = 0; f < m_module.functions.size(); ++f) profile->loops[f].assign(m_module.functions[f].code.size(), 0);
+  }
+  // トップレベルを実行してグローバル変数のフレームを返す
+  std::shared_ptr<Frame> run() {
+    auto globals = std::make_shared<Frame>(m_module.globalCount);
+    if (m_profile) execute<true>(m_module.functions[0], globals->slots.data());
+    else execute<false>(m_module.functions[0], globals->slots.data());
+    return globals;
+  }
+private:
+  // 値スタックの最初の大きさ（足りなくなれば倍にし、深さはMaxCallDepthで制限する）
+  static constexpr size_t InitialStackSize = 1 << 16;
+  // 呼び出し元の状態
+  struct CallFrame {
+    const FunctionProto* proto;
+    const Instruction* ip;
+    Value* locals;
+    Closure* closure;
+    uint32_t check;
+  };
+  // 多相のインラインキャッシュ（klass[0]が最初に調べる項目、空きはnullptr）
+  struct MemberCache {
+    static constexpr size_t Ways = 4;
+    const ClassInfo* klass[Ways] = {};
+    uint32_t index[Ways] = {};
+  };
+  const BytecodeModule& m_module;
+  Heap& m_heap;
+  std::vector<Value> m_stack;
+  // 1つのフレームが使う値スタックの最大（ローカル変数と式の評価）
+  size_t m_frameBound = 0;
+  std::vector<CallFrame> m_calls;
+  std::vector<MemberCache> m_caches;
+  VMProfile* m_profile = nullptr;
+
+  // klass[0]で外れたときにキャッシュを調べ、なければ名前で引いて先頭に追加する
+  uint32_t lookupMember(const uint32_t site, const ClassInfo& klass) {
+    MemberCache& cache = m_caches[site];
+    for (size_t i = 1; i < MemberCache::Ways; ++i) {
+      if (cache.klass[i] == &klass) return cache.index[i];
+    }
+    const int32_t found = klass.find(m_module.memberSites[site].member);
+    if (found < 0) unknownMember(klass, m_module.memberSites[site].member);
+    // 埋まっていれば最後の項目を捨てる
+    std::copy_backward(cache.klass, cache.klass + MemberCache::Ways - 1, cache.klass + MemberCache::Ways);
+    std::copy_backward(cache.index, cache.index + MemberCache::Ways - 1, cache.index + MemberCache::Ways);
+    cache.klass[0] = &klass;
+    cache.index[0] = static_cast<uint32_t>(found);
+    return cache.index[0];
+  }
+  uint32_t memberIndex(const uint32_t site, const ClassInfo& klass) {
+    const MemberCache& cache = m_caches[site];
+    return cache.klass[0] == &klass ? cache.index[0] : lookupMember(site, klass);
+  }
+  // 安全点でのGC（値スタックの使っている部分とトップレベルの変数がルート）
+  // 各フレームのクロージャはローカル変数の直前にあるので、移動したものをそこから指し直す
+  void collect(Value* const globals, Value* const sp, Value* const locals, Closure*& closure) {
+    m_heap.collect({std::span(m_stack.data(), sp), std::span(globals, m_module.globalCount)});
+    if (closure) closure = &locals[-1].asClosure();
+    for (CallFrame& frame : m_calls) {
+      if (frame.closure) frame.closure = &frame.locals[-1].asClosure();
+    }
+  }
+
+  // 値スタックを広げ、呼び出し元のフレームを新しい領域へ移す（使っているのは先頭からusedまで）
+  // 実行中のポインタはVM_GROWが位置から指し直す
+  [[gnu::cold]] void growStack(const size_t used, const size_t needed) {
+    std::vector<Value> stack(std::max(m_stack.size() * 2, used + needed));
+    std::copy(m_stack.data(), m_stack.data() + used, stack.data());
+    for (CallFrame& frame : m_calls) frame.locals = stack.data() + (frame.locals - m_stack.data());
+    m_stack = std::move(stack);
+  }
+
+  template<bool Profile>
+  void execute(const FunctionProto& entry, Value* const globals) {
+    const FunctionProto* proto = &entry;
+    const Instruction* code = proto->code.data();
+    const Instruction* ip = code;
+    const Value* constants = m_module.constants.data();
+    // トップレベルは変数をすべてglobalsに置くのでローカル変数を持たない
+    Value* locals = m_stack.data() + 1;
+    Closure* closure = nullptr;
+    // 末尾呼び出しで持ち越した戻り値の変換（TypeKind+1、0なら変換なし）
+    uint32_t check = 0;
+    // spは次に積む位置
+    Value* sp = locals + proto->frameSize;
+    const Value* stackEnd = m_stack.data() + m_stack.size();
+// spの後ろにneeded個が入るよう値スタックを広げ、spとlocalsを同じ位置へ指し直す
+# define VM_GROW(needed) do { \
+      const size_t spAt = sp - m_stack.data(); \
+      const size_t localsAt = locals - m_stack.data(); \
+      growStack(spAt, (needed)); \
+      sp = m_stack.data() + spAt; \
+      locals = m_stack.data() + localsAt; \
+      stackEnd = m_stack.data() + m_stack.size(); \
+    } while (false)
+    if (sp + proto->maxStack > stackEnd) VM_GROW(proto->maxStack);
+    Instruction word;
+    if constexpr (Profile) ++m_profile->calls[proto - m_module.functions.data()];
+
+# define VM_INT(v) (v).asInt()
+# define VM_REAL(v) (v).asReal()
+# define VM_BINARY(type, expr) do { \
+      const auto l = type(sp[-2]); \
+      const auto r = type(sp[-1]); \
+      sp[-2] = (expr); \
+      --sp; \
+    } while (false)
+
+# define VM_PROFILE_CALL(target) do { \
+      if constexpr (Profile) ++m_profile->calls[(target) - m_module.functions.data()]; \
+    } while (false)
+
+// 値スタックの[locals, sp)はGCのルートなので、引数の後ろのローカル変数は前の値を消しておく
+# define VM_ENTER(target, frame, callee) do { \
+      if (m_calls.size() >= MaxCallDepth) throw std::runtime_error("Stack overflow"); \
+      std::fill(sp, std::max(sp, (frame) + (target)->frameSize), Value()); \
+      VM_PROFILE_CALL(target); \
+      m_calls.push_back(CallFrame{proto, ip, locals, closure, check}); \
+      closure = (callee); \
+      check = 0; \
+      locals = (frame); \
+      sp = locals + (target)->frameSize; \
+      proto = (target); \
+      code = ip = proto->code.data(); \
+    } while (false)
+
+// 呼び出し先のクロージャと引数を現在のフレームの先頭へ移し、残りのローカル変数を消す
+# define VM_TAIL(target, count) do { \
+      Value* const from = sp - (count) - 1; \
+      std::copy(from, from + (count) + 1, locals - 1); \
+      std::fill(locals + (count), locals + (target)->frameSize, Value()); \
+      closure = &locals[-1].asClosure(); \
+      VM_PROFILE_CALL(target); \
+      sp = locals + (target)->frameSize; \
+      proto = (target); \
+      code = ip = proto->code.data(); \
+    } while (false)
+
+// ジャンプと呼び出しの前でGCする（命令の境目では全ての値が値スタックかトップレベルの変数にある）
+# define VM_SAFEPOINT() do { \
+      if (m_heap.collectRequested()) collect(globals, sp, locals, closure); \
+    } while (false)
+
+// 呼び出しの前に、spより後ろへどのフレームも入るだけの値スタックを空ける（呼び出し先のフレームはsp以前から始まる）
+# define VM_RESERVE() do { \
+      if (static_cast<size_t>(stackEnd - sp) < m_frameBound) VM_GROW(m_frameBound); \
+    } while (false)
+
+# if ESPERO_COMPUTED_GOTO
+    static const void* const labels[] = {
+#   define VM_LABEL(name) &&op_##name,
+      ESPERO_OPCODES(VM_LABEL)
+#   undef VM_LABEL
+    };
+#   define VM_CASE(name) op_##name
+#   define VM_NEXT() do { word = *ip++; goto *labels[word & 0xFF]; } while (false)
+#   define VM_LOOP() VM_NEXT();
+#   define VM_END()
+# else
+#   define VM_CASE(name) case OpCode::name
+#   define VM_NEXT() continue
+#   define VM_LOOP() for (;;) { word = *ip++; switch (opcodeOf(word))
+#   define VM_END() }
+# endif
+
+    VM_LOOP() {
+      VM_CASE(Constant): *sp++ = constants[operandOf(word)]; VM_NEXT();
+      VM_CASE(Int): *sp++ = static_cast<int64_t>(immediateOf(word)); VM_NEXT();
+      VM_CASE(True): *sp++ = true; VM_NEXT();
+      VM_CASE(False): *sp++ = false; VM_NEXT();
+      VM_CASE(Nil): *sp++ = Value(); VM_NEXT();
+      VM_CASE(Pop): --sp; VM_NEXT();
+      VM_CASE(LoadLocal): *sp++ = locals[operandOf(word)]; VM_NEXT();
+      VM_CASE(StoreLocal): locals[operandOf(word)] = std::move(*--sp); VM_NEXT();
+      VM_CASE(LoadGlobal): *sp++ = globals[operandOf(word)]; VM_NEXT();
+      VM_CASE(StoreGlobal): globals[operandOf(word)] = std::move(*--sp); VM_NEXT();
+      VM_CASE(LoadCapture): *sp++ = closure->captures()[operandOf(word)]; VM_NEXT();
+      VM_CASE(LoadSelf): *sp++ = locals[-1]; VM_NEXT();
+      VM_CASE(NewBox): locals[operandOf(word)] = box(*--sp); VM_NEXT();
+      VM_CASE(LoadBoxed): *sp++ = unbox(locals[operandOf(word)]); VM_NEXT();
+      VM_CASE(StoreBoxed): storeBoxed(locals[operandOf(word)], *--sp); VM_NEXT();
+      VM_CASE(LoadCaptureBoxed): *sp++ = unbox(closure->captures()[operandOf(word)]); VM_NEXT();
+      VM_CASE(StoreCaptureBoxed): storeBoxed(closure->captures()[operandOf(word)], *--sp); VM_NEXT();
+
+      // オーバーフローはbinaryOpと同じく折り返す
+      VM_CASE(AddInt): VM_BINARY(VM_INT, addInt(l, r)); VM_NEXT();
+      VM_CASE(SubInt): VM_BINARY(VM_INT, subInt(l, r)); VM_NEXT();
+      VM_CASE(MulInt): VM_BINARY(VM_INT, mulInt(l, r)); VM_NEXT();
+      VM_CASE(DivInt): VM_BINARY(VM_INT, divInt(l, r)); VM_NEXT();
+      VM_CASE(EqInt): VM_BINARY(VM_INT, l == r); VM_NEXT();
+      VM_CASE(NEqInt): VM_BINARY(VM_INT, l != r); VM_NEXT();
+      VM_CASE(LtInt): VM_BINARY(VM_INT, l < r); VM_NEXT();
+      VM_CASE(GtInt): VM_BINARY(VM_INT, l > r); VM_NEXT();
+      VM_CASE(LeInt): VM_BINARY(VM_INT, l <= r); VM_NEXT();
+      VM_CASE(GeInt): VM_BINARY(VM_INT, l >= r); VM_NEXT();
+
+      VM_CASE(AddReal): VM_BINARY(VM_REAL, l + r); VM_NEXT();
+      VM_CASE(SubReal): VM_BINARY(VM_REAL, l - r); VM_NEXT();
+      VM_CASE(MulReal): VM_BINARY(VM_REAL, l * r); VM_NEXT();
+      VM_CASE(DivReal): VM_BINARY(VM_REAL, l / r); VM_NEXT();
+      VM_CASE(EqReal): VM_BINARY(VM_REAL, l == r); VM_NEXT();
+      VM_CASE(NEqReal): VM_BINARY(VM_REAL, l != r); VM_NEXT();
+      VM_CASE(LtReal): VM_BINARY(VM_REAL, l < r); VM_NEXT();
+      VM_CASE(GtReal): VM_BINARY(VM_REAL, l > r); VM_NEXT();
+      VM_CASE(LeReal): VM_BINARY(VM_REAL, l <= r); VM_NEXT();
+      VM_CASE(GeReal): VM_BINARY(VM_REAL, l >= r); VM_NEXT();
+
+      VM_CASE(Add):
+      VM_CASE(Sub):
+      VM_CASE(Mul):
+      VM_CASE(Div):
+      VM_CASE(Eq):
+      VM_CASE(NEq):
+      VM_CASE(Lt):
+      VM_CASE(Gt):
+      VM_CASE(Le):
+      VM_CASE(Ge): {
+        const auto op = static_cast<BinaryOpNode::OpType>(static_cast<uint8_t>(opcodeOf(word)) - static_cast<uint8_t>(OpCode::Add));
+        sp[-2] = binaryOp(op, sp[-2], sp[-1]);
+        --sp;
+        VM_NEXT();
+      }
+      VM_CASE(Concat):
+        sp[-2] = Value::concat(sp[-2].asString(), sp[-1].asString());
+        --sp;
+        VM_NEXT();
+
+      VM_CASE(IntToReal): sp[-1] = static_cast<double>(VM_INT(sp[-1])); VM_NEXT();
+      VM_CASE(CoerceReal): coerceReal(sp[-1]); VM_NEXT();
+      VM_CASE(CheckType): checkType(sp[-1], static_cast<TypeKind>(operandOf(word))); VM_NEXT();
+      VM_CASE(CheckClass): checkClass(sp[-1], m_module.classes[operandOf(word)].type); VM_NEXT();
+      VM_CASE(CoerceParam): coerce(locals[operandOf(word) >> 8], static_cast<TypeKind>(operandOf(word) & 0xFF)); VM_NEXT();
+
+      VM_CASE(Jump):
+        VM_SAFEPOINT();
+        // 後方ジャンプはループの先頭へ戻る
+        if constexpr (Profile) {
+          if (operandOf(word) < static_cast<uint32_t>(ip - code)) ++m_profile->loops[proto - m_module.functions.data()][operandOf(word)];
+        }
+        ip = code + operandOf(word);
+        VM_NEXT();
+      VM_CASE(JumpIfFalse): {
+        const Value& condition = *--sp;
+        if (!condition.isBool()) throw std::runtime_error("Condition must be bulea");
+        if (!condition.asBool()) ip = code + operandOf(word);
+        VM_NEXT();
+      }
+
+      VM_CASE(New): {
+        const ClassInfo* klass = &m_module.classes[operandOf(word)];
+        Value created = Instance::make(klass);
+        sp -= klass->fieldCount;
+        std::move(sp, sp + klass->fieldCount, created.asInstance().fields());
+        *sp++ = std::move(created);
+        VM_NEXT();
+      }
+      VM_CASE(GetMember): {
+        Instance& instance = instanceOf(sp[-1]);
+        const uint32_t index = memberIndex(operandOf(word), *instance.klass);
+        // フィールドはインスタンス内の位置をそのまま読み、メソッドはインスタンスに束縛する
+        Value member;
+        if (index < instance.fieldCount) {
+          member = instance.fields()[index];
+        } else {
+          const FunctionProto* method = &m_module.functions[instance.klass->methods[index - instance.fieldCount]];
+          member = bindMethod(nullptr, method, method->captureCount, sp[-1]);
+        }
+        sp[-1] = std::move(member);
+        VM_NEXT();
+      }
+      VM_CASE(SetMember): {
+        Instance& instance = instanceOf(sp[-2]);
+        const uint32_t site = operandOf(word);
+        const uint32_t index = memberIndex(site, *instance.klass);
+        if (index >= instance.fieldCount) {
+          throw std::runtime_error("Cannot assign to method " + std::string(symbolTable().name(m_module.memberSites[site].member)));
+        }
+        // 静的に型が分からなかった箇所だけフィールドの型へ合わせる
+        if (m_module.memberSites[site].klass < 0) coerce(sp[-1], instance.klass->fieldTypes[index]);
+        storeField(instance, index, sp[-1]);
+        sp -= 2;
+        VM_NEXT();
+      }
+      VM_CASE(Closure): {
+        const FunctionProto* callee = &m_module.functions[operandOf(word)];
+        Value created = Closure::make(nullptr, callee, callee->captureCount);
+        sp -= callee->captureCount;
+        std::move(sp, sp + callee->captureCount, created.asClosure().captures());
+        *sp++ = std::move(created);
+        VM_NEXT();
+      }
+      VM_CASE(Call): {
+        VM_SAFEPOINT();
+        VM_RESERVE();
+        if (!sp[-2].isClosure() || !sp[-2].asClosure().proto) throw std::runtime_error("Called value is not a funkcia");
+        Closure* const callee = &sp[-2].asClosure();
+        const FunctionProto* target = callee->proto;
+        // 引数の位置をそのまま新しいローカル変数の先頭にする
+        Value* const frame = sp - 1;
+        VM_ENTER(target, frame, callee);
+        VM_NEXT();
+      }
+      VM_CASE(CallDirect): {
+        VM_SAFEPOINT();
+        VM_RESERVE();
+        // 呼び出し先はコンパイル時に決まっていて、スタック上のクロージャは捕捉した変数だけに使う
+        const FunctionProto* target = &m_module.functions[operandOf(word)];
+        Value* const frame = sp - target->arity;
+        if (!frame[-1].isClosure()) throw std::runtime_error("Called value is not a funkcia");
+        VM_ENTER(target, frame, &frame[-1].asClosure());
+        VM_NEXT();
+      }
+      VM_CASE(TailCall): {
+        VM_SAFEPOINT();
+        VM_RESERVE();
+        if (!sp[-2].isClosure() || !sp[-2].asClosure().proto) throw std::runtime_error("Called value is not a funkcia");
+        Closure* const callee = &sp[-2].asClosure();
+        const FunctionProto* target = callee->proto;
+        const uint32_t next = operandOf(word);
+        // 別の変換を持ち越していれば通常の呼び出しにして、続く変換とReturnで返す
+        if (next && check && next != check) {
+          VM_ENTER(target, sp - 1, callee);
+          VM_NEXT();
+        }
+        if (next) check = next;
+        VM_TAIL(target, 1u);
+        VM_NEXT();
+      }
+      VM_CASE(TailCallDirect): {
+        VM_SAFEPOINT();
+        VM_RESERVE();
+        const FunctionProto* target = &m_module.functions[operandOf(word) >> 4];
+        Value* const frame = sp - target->arity;
+        if (!frame[-1].isClosure()) throw std::runtime_error("Called value is not a funkcia");
+        const uint32_t next = operandOf(word) & 0xF;
+        if (next && check && next != check) {
+          VM_ENTER(target, frame, &frame[-1].asClosure());
+          VM_NEXT();
+        }
+        if (next) check = next;
+        VM_TAIL(target, target->arity);
+        VM_NEXT();
+      }
+      VM_CASE(Return): {
+        if (m_calls.empty()) return;
+        // 呼び出されたクロージャの位置に戻り値を置く
+        Value result = sp[-1];
+        if (check) coerce(result, static_cast<TypeKind>(check - 1));
+        sp = locals;
+        sp[-1] = std::move(result);
+        const CallFrame& caller = m_calls.back();
+        proto = caller.proto;
+        ip = caller.ip;
+        code = proto->code.data();
+        locals = caller.locals;
+        closure = caller.closure;
+        check = caller.check;
+        m_calls.pop_back();
+        VM_NEXT();
+      }
+      VM_CASE(NoReturn):
+        throw std::runtime_error("Function ended without reveni");
+    }
+    VM_END()
+
+# undef VM_INT
+# undef VM_REAL
+# undef VM_BINARY
+# undef VM_PROFILE_CALL
+# undef VM_ENTER
+# undef VM_TAIL
+# undef VM_SAFEPOINT
+# undef VM_RESERVE
+# undef VM_GROW
+# undef VM_CASE
+# undef VM_NEXT
+# undef VM_LOOP
+# undef VM_END
+  }
+};